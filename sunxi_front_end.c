@@ -19,30 +19,41 @@
 #include <linux/regmap.h>
 #include <linux/delay.h>
 #include <uapi/drm/drm_fourcc.h>
+#include <linux/dma-buf.h>
 #include <linux/dma-mapping.h>
 #include <linux/slab.h>
 #include <linux/of.h>
+#include <linux/reservation.h>
+#include <linux/interrupt.h>
+#include <linux/pm_runtime.h>
+#include <linux/math64.h>
 
 #include <uapi/linux/videodev2.h>
 #include <media/v4l2-device.h>
 #include <media/v4l2-mem2mem.h>
 #include <media/v4l2-ioctl.h>
+#include <media/v4l2-event.h>
 #include <media/videobuf2-dma-contig.h>
 
 #include <uapi/misc/sunxi_front_end.h>
 #include "sunxi_front_end.h"
 #include "sunxi_front_end_dma_ctrl.h"
 #include "sunxi_front_end_color_space_converter.h"
+#include "sunxi_front_end_format.h"
 #include "sunxi_front_end_registers.h"
+#include "sunxi_front_end_scaler_coef.h"
 
 #define FRONT_END_MODULE_NAME	"sunxi_front_end"
-#define SUNXI_DE_FE_CAPTURE	BIT(1)
-#define SUNXI_DE_FE_OUTPUT	BIT(0)
+/* The OUTPUT queue is read by the front-end, the CAPTURE queue written. */
+#define SUNXI_DE_FE_CAPTURE	FE_FORMAT_OUT
+#define SUNXI_DE_FE_OUTPUT	FE_FORMAT_IN
 #define NUM_FORMATS		ARRAY_SIZE(formats)
 
 uint32_t sunxi_de_fe_debug_lvl = 0;
 char *de_fe_msg;
 
+static int sunxi_fe_misc_open(struct inode *inode, struct file *filp);
+static int sunxi_fe_misc_release(struct inode *inode, struct file *filp);
 static long sunxi_fe_ioctl(struct file *filp,
     unsigned int cmd, unsigned long arg);
 static ssize_t proc_sunxi_de_fe_write(struct file *filp, const char *buf,
@@ -50,10 +61,29 @@ static ssize_t proc_sunxi_de_fe_write(struct file *filp, const char *buf,
 
 static int sunxi_fe_release(struct file *file);
 static int sunxi_fe_open(struct file *file);
-
-static struct sunxi_fe_device *sunxi_fe_dev;
-static struct miscdevice fe_miscdevice = {0};
+static void sunxi_fe_stage_next(struct sunxi_fe_node *node);
+static void sunxi_fe_drain(struct sunxi_de_fe_ctx *ctx);
+static int sunxi_fe_build_regs(struct sunxi_fe_config *cfg,
+    struct fe_geometry *geo, struct fe_reg_image *img, unsigned int nr_imgs);
+static int sunxi_fe_sync_regs(struct sunxi_fe_device *sunxi_fe_dev);
+
+/* Front-ends by instance and the node they share when aggregated. */
+static DEFINE_MUTEX(sunxi_fe_cores_lock);
+static struct sunxi_fe_device *sunxi_fe_cores[SUNXI_FE_MAX_CORES];
+static struct sunxi_fe_node *sunxi_fe_shared_node;
+/* The proc file and sysctls go with the last front-end. */
 static struct proc_dir_entry *sunxi_fe_proc_entry;
+static struct sunxi_fe_device *sunxi_fe_proc_dev;
+static unsigned int sunxi_fe_proc_users;
+
+/*
+ * Lets the front-ends share one video device. Its jobs run on whichever
+ * front-end is idle, which doubles the throughput of several streams.
+ */
+static bool aggregate;
+module_param(aggregate, bool, 0444);
+MODULE_PARM_DESC(aggregate, "Run the jobs of one video device on all "
+    "front-ends");
 
 static struct ctl_table sunxi_de_fe_root_table[] = {
 	{ 	.procname     = "sunxi_de_fe_debug_lvl",
@@ -66,101 +96,245 @@ static struct ctl_table sunxi_de_fe_root_table[] = {
 
 static struct ctl_table_header *sunxi_de_fe_table_header;
 
+/*
+ * Frame control holds the self clearing ready bits and the frame start, the
+ * status registers are updated by the hardware. Everything else is only
+ * changed by us and is served from the register cache.
+ */
+static bool sunxi_fe_volatile_reg(struct device *dev, unsigned int reg)
+{
+
+	switch (reg) {
+	case DEFE_FRM_CTRL_REG:
+	case DEFE_INT_STATUS_REG:
+	case DEFE_STATUS_REG:
+		return true;
+	default:
+		return false;
+	}
+}
+
+/* Last register of the scaler coefficient banks of channel 1. */
+#define SUNXI_FE_MAX_REGISTER \
+    (DEFE_CH1_VERTCOEF + (DEFE_NR_COEF_PHASES - 1) * 4)
+
+/*
+ * Registers that exist, the holes in between are neither read nor written,
+ * also not by regcache_sync().
+ */
+static bool sunxi_fe_valid_reg(struct device *dev, unsigned int reg)
+{
+
+	switch (reg) {
+	case DEFE_EN_REG ... DEFE_BYPASS_REG:
+	case DEFE_BUF_ADDR0_REG ... DEFE_TB_OFF2_REG:
+	case DEFE_LINESTRD0_REG ... DEFE_STATUS_REG:
+	case DEFE_CSC_COEF00_REG ... DEFE_CSC_COEF23_REG:
+	case DEFE_WB_LINESTRD_EN_REG ... DEFE_WB_LINESTRD2_REG:
+	case DEFE_CH0_INSIZE_REG ... DEFE_CH0_VERTPHASE1_REG:
+	case DEFE_CH1_INSIZE_REG ... DEFE_CH1_VERTPHASE1_REG:
+	case DEFE_CH0_HORZCOEF0 ... DEFE_CH0_VERTCOEF +
+	    (DEFE_NR_COEF_PHASES - 1) * 4:
+	case DEFE_CH1_HORZCOEF0 ... SUNXI_FE_MAX_REGISTER:
+		return true;
+	default:
+		return false;
+	}
+}
+
+/*
+ * Reset values of the cached registers, which are all zero. The scaler
+ * coefficients live in RAM that has no reset value, so they are always
+ * written back by regcache_sync().
+ */
+static const struct reg_default sunxi_fe_reg_defaults[] = {
+	{ DEFE_EN_REG,			0 },
+	{ DEFE_BYPASS_REG,		0 },
+	{ DEFE_BUF_ADDR0_REG,		0 },
+	{ DEFE_BUF_ADDR1_REG,		0 },
+	{ DEFE_BUF_ADDR2_REG,		0 },
+	{ DEFE_FIELD_CTRL_REG,		0 },
+	{ DEFE_TB_OFF0_REG,		0 },
+	{ DEFE_TB_OFF1_REG,		0 },
+	{ DEFE_TB_OFF2_REG,		0 },
+	{ DEFE_LINESTRD0_REG,		0 },
+	{ DEFE_LINESTRD1_REG,		0 },
+	{ DEFE_LINESTRD2_REG,		0 },
+	{ DEFE_INPUT_FMT_REG,		0 },
+	{ DEFE_WB_ADDR0_REG,		0 },
+	{ DEFE_WB_ADDR1_REG,		0 },
+	{ DEFE_WB_ADDR2_REG,		0 },
+	{ DEFE_OUTPUT_FMT_REG,		0 },
+	{ DEFE_INT_EN_REG,		0 },
+	{ DEFE_CSC_COEF00_REG,		0 },
+	{ DEFE_CSC_COEF01_REG,		0 },
+	{ DEFE_CSC_COEF02_REG,		0 },
+	{ DEFE_CSC_COEF03_REG,		0 },
+	{ DEFE_CSC_COEF10_REG,		0 },
+	{ DEFE_CSC_COEF11_REG,		0 },
+	{ DEFE_CSC_COEF12_REG,		0 },
+	{ DEFE_CSC_COEF13_REG,		0 },
+	{ DEFE_CSC_COEF20_REG,		0 },
+	{ DEFE_CSC_COEF21_REG,		0 },
+	{ DEFE_CSC_COEF22_REG,		0 },
+	{ DEFE_CSC_COEF23_REG,		0 },
+	{ DEFE_WB_LINESTRD_EN_REG,	0 },
+	{ DEFE_WB_LINESTRD0_REG,	0 },
+	{ DEFE_WB_LINESTRD1_REG,	0 },
+	{ DEFE_WB_LINESTRD2_REG,	0 },
+	{ DEFE_CH0_INSIZE_REG,		0 },
+	{ DEFE_CH0_OUTSIZE_REG,		0 },
+	{ DEFE_CH0_HORZFACT_REG,	0 },
+	{ DEFE_CH0_VERTFACT_REG,	0 },
+	{ DEFE_CH0_HORZPHASE_REG,	0 },
+	{ DEFE_CH0_VERTPHASE0_REG,	0 },
+	{ DEFE_CH0_VERTPHASE1_REG,	0 },
+	{ DEFE_CH1_INSIZE_REG,		0 },
+	{ DEFE_CH1_OUTSIZE_REG,		0 },
+	{ DEFE_CH1_HORZFACT_REG,	0 },
+	{ DEFE_CH1_VERTFACT_REG,	0 },
+	{ DEFE_CH1_HORZPHASE_REG,	0 },
+	{ DEFE_CH1_VERTPHASE0_REG,	0 },
+	{ DEFE_CH1_VERTPHASE1_REG,	0 },
+};
+
 static struct regmap_config sunxi_fe_regmap_config = {
-	.reg_bits	= 32,
-	.val_bits	= 32,
-	.reg_stride	= 4,
-	.max_register 	= 0x0A14
+	.reg_bits		= 32,
+	.val_bits		= 32,
+	.reg_stride		= 4,
+	.max_register		= SUNXI_FE_MAX_REGISTER,
+	.readable_reg		= sunxi_fe_valid_reg,
+	.writeable_reg		= sunxi_fe_valid_reg,
+	.volatile_reg		= sunxi_fe_volatile_reg,
+	.reg_defaults		= sunxi_fe_reg_defaults,
+	.num_reg_defaults	= ARRAY_SIZE(sunxi_fe_reg_defaults),
+	.cache_type		= REGCACHE_FLAT,
 };
 
+/*
+ * V4L2 fourccs of the formats in sunxi_front_end_format.c. Whether a format
+ * can be used on the OUTPUT or the CAPTURE queue, and the size of its
+ * buffers, follow from its descriptor.
+ */
 static struct sunxi_de_fe_fmt formats[] = {
 	{
 		.fourcc = V4L2_PIX_FMT_SUNXI,
-		.types	= SUNXI_DE_FE_OUTPUT,
-		.depth = 8,
+		.drm_fourcc = FE_FORMAT_MB32_NV12,
 		.num_planes = 2,
 	},
 	{
-		.fourcc = V4L2_PIX_FMT_SUNXI,
-		.types	= SUNXI_DE_FE_CAPTURE,
-		.depth = 8,
+		.fourcc = V4L2_PIX_FMT_NV12M,
+		.drm_fourcc = DRM_FORMAT_NV12,
 		.num_planes = 2,
 	},
+	{
+		.fourcc = V4L2_PIX_FMT_NV21M,
+		.drm_fourcc = DRM_FORMAT_NV21,
+		.num_planes = 2,
+	},
+	{
+		.fourcc = V4L2_PIX_FMT_NV12,
+		.drm_fourcc = DRM_FORMAT_NV12,
+		.num_planes = 1,
+	},
+	{
+		.fourcc = V4L2_PIX_FMT_NV21,
+		.drm_fourcc = DRM_FORMAT_NV21,
+		.num_planes = 1,
+	},
+	{
+		.fourcc = V4L2_PIX_FMT_NV16M,
+		.drm_fourcc = DRM_FORMAT_NV16,
+		.num_planes = 2,
+	},
+	{
+		.fourcc = V4L2_PIX_FMT_NV61M,
+		.drm_fourcc = DRM_FORMAT_NV61,
+		.num_planes = 2,
+	},
+	{
+		.fourcc = V4L2_PIX_FMT_NV16,
+		.drm_fourcc = DRM_FORMAT_NV16,
+		.num_planes = 1,
+	},
+	{
+		.fourcc = V4L2_PIX_FMT_NV61,
+		.drm_fourcc = DRM_FORMAT_NV61,
+		.num_planes = 1,
+	},
+	{
+		.fourcc = V4L2_PIX_FMT_YUV420M,
+		.drm_fourcc = DRM_FORMAT_YUV420,
+		.num_planes = 3,
+	},
+	{
+		.fourcc = V4L2_PIX_FMT_YVU420M,
+		.drm_fourcc = DRM_FORMAT_YVU420,
+		.num_planes = 3,
+	},
+	{
+		.fourcc = V4L2_PIX_FMT_YUV420,
+		.drm_fourcc = DRM_FORMAT_YUV420,
+		.num_planes = 1,
+	},
+	{
+		.fourcc = V4L2_PIX_FMT_YVU420,
+		.drm_fourcc = DRM_FORMAT_YVU420,
+		.num_planes = 1,
+	},
+	{
+		.fourcc = V4L2_PIX_FMT_YUV422M,
+		.drm_fourcc = DRM_FORMAT_YUV422,
+		.num_planes = 3,
+	},
+	{
+		.fourcc = V4L2_PIX_FMT_YUV422P,
+		.drm_fourcc = DRM_FORMAT_YUV422,
+		.num_planes = 1,
+	},
+	{
+		.fourcc = V4L2_PIX_FMT_YUV411P,
+		.drm_fourcc = DRM_FORMAT_YUV411,
+		.num_planes = 1,
+	},
+	{
+		.fourcc = V4L2_PIX_FMT_YUV444M,
+		.drm_fourcc = DRM_FORMAT_YUV444,
+		.num_planes = 3,
+	},
+	{
+		.fourcc = V4L2_PIX_FMT_YUYV,
+		.drm_fourcc = DRM_FORMAT_YUYV,
+		.num_planes = 1,
+	},
+	{
+		.fourcc = V4L2_PIX_FMT_UYVY,
+		.drm_fourcc = DRM_FORMAT_UYVY,
+		.num_planes = 1,
+	},
+	{
+		.fourcc = V4L2_PIX_FMT_YVYU,
+		.drm_fourcc = DRM_FORMAT_YVYU,
+		.num_planes = 1,
+	},
+	{
+		.fourcc = V4L2_PIX_FMT_VYUY,
+		.drm_fourcc = DRM_FORMAT_VYUY,
+		.num_planes = 1,
+	},
+	{
+		.fourcc = V4L2_PIX_FMT_XBGR32,
+		.drm_fourcc = DRM_FORMAT_XRGB8888,
+		.num_planes = 1,
+	},
+	{
+		.fourcc = V4L2_PIX_FMT_XRGB32,
+		.drm_fourcc = DRM_FORMAT_BGRX8888,
+		.num_planes = 1,
+	},
 };
 
-static const u32 sun4i_vert_coef[32] = {
-	0x00004000, 0x000140ff, 0x00033ffe, 0x00043ffd,
-	0x00063efc, 0xff083dfc, 0x000a3bfb, 0xff0d39fb,
-	0xff0f37fb, 0xff1136fa, 0xfe1433fb, 0xfe1631fb,
-	0xfd192ffb, 0xfd1c2cfb, 0xfd1f29fb, 0xfc2127fc,
-	0xfc2424fc, 0xfc2721fc, 0xfb291ffd, 0xfb2c1cfd,
-	0xfb2f19fd, 0xfb3116fe, 0xfb3314fe, 0xfa3611ff,
-	0xfb370fff, 0xfb390dff, 0xfb3b0a00, 0xfc3d08ff,
-	0xfc3e0600, 0xfd3f0400, 0xfe3f0300, 0xff400100,
-};
-
-static const u32 sun4i_horz_coef[64] = {
-	0x40000000, 0x00000000, 0x40fe0000, 0x0000ff03,
-	0x3ffd0000, 0x0000ff05, 0x3ffc0000, 0x0000ff06,
-	0x3efb0000, 0x0000ff08, 0x3dfb0000, 0x0000ff09,
-	0x3bfa0000, 0x0000fe0d, 0x39fa0000, 0x0000fe0f,
-	0x38fa0000, 0x0000fe10, 0x36fa0000, 0x0000fe12,
-	0x33fa0000, 0x0000fd16, 0x31fa0000, 0x0000fd18,
-	0x2ffa0000, 0x0000fd1a, 0x2cfa0000, 0x0000fc1e,
-	0x29fa0000, 0x0000fc21, 0x27fb0000, 0x0000fb23,
-	0x24fb0000, 0x0000fb26, 0x21fb0000, 0x0000fb29,
-	0x1ffc0000, 0x0000fa2b, 0x1cfc0000, 0x0000fa2e,
-	0x19fd0000, 0x0000fa30, 0x16fd0000, 0x0000fa33,
-	0x14fd0000, 0x0000fa35, 0x11fe0000, 0x0000fa37,
-	0x0ffe0000, 0x0000fa39, 0x0dfe0000, 0x0000fa3b,
-	0x0afe0000, 0x0000fa3e, 0x08ff0000, 0x0000fb3e,
-	0x06ff0000, 0x0000fb40, 0x05ff0000, 0x0000fc40,
-	0x03ff0000, 0x0000fd41, 0x01ff0000, 0x0000fe42,
-};
-
-
-#ifdef HACK_BACKEND_LAYER2_TO_FRONTEND
-static void hack_enable_be0_layer2_to_fe(uint16_t width, uint16_t height) {
-	void __iomem *io;
-	uint32_t val, base;
-
-	base = SUN7I_DEBE_BASE;
-
-	io = ioremap(SUN7I_DEBE_BASE, SUN7I_DEBE_SIZE);
-
-	val = readl(io + SUN7I_DEBE_MODCTL_REG);
-	writel(val | ENABLE_LAY2, io + SUN7I_DEBE_MODCTL_REG);
-
-	writel(LAYSIZE_HEIGHT(height) | LAYSIZE_WIDTH(width),
-	    io + SUN7I_DEBE_LAYSIZE_REG_LAY2);
-
-	writel(LAY_COOR_Y(0) | LAY_COOR_X(0), io + SUN7I_DEBE_LAYCOOR_LAY2);
-
-	writel(LAY_GLBALPHA(MAX_ALPHA) | LAY_PRISEL(DEF_VID_LAY_PRI) |
-	    LAY_VDOEN(EN_VID_CHAN), io + SUN7I_DEBE_ATTCTL_REG0_LAY2);
-
-	writel(LAY_FMT(LAY_FMT_ARGB_8888), io + SUN7I_DEBE_ATTCTL_REG1_LAY2);
-
-	writel(LOAD_REG, io + SUN7I_DEBE_REGBUFFCTL);
-}
-
-static void hack_disable_be0_layer2_to_fe(void) {
-	void __iomem *io;
-	uint32_t val;
-
-	io = ioremap(SUN7I_DEBE_BASE, SUN7I_DEBE_SIZE);
-
-	//It is enough just to disable layer2
-	val = readl(io + SUN7I_DEBE_MODCTL_REG);
-	writel(val & ~(ENABLE_LAY2), io + SUN7I_DEBE_MODCTL_REG);
-
-	writel(0x0, io + SUN7I_DEBE_ATTCTL_REG0_LAY2);
-
-	writel(LOAD_REG, io + SUN7I_DEBE_REGBUFFCTL);
-}
-#endif
-
-static struct sunxi_de_fe_fmt *find_format(struct v4l2_format *f)
+static struct sunxi_de_fe_fmt *find_format(struct v4l2_format *f, u32 types)
 {
 	struct sunxi_de_fe_fmt *fmt;
 	unsigned int k;
@@ -168,7 +342,8 @@ static struct sunxi_de_fe_fmt *find_format(struct v4l2_format *f)
 	PRINT_DE_FE("de_fe %s();\n", __FUNCTION__);
 	for (k = 0; k < NUM_FORMATS; k++) {
 		fmt = &formats[k];
-		if (fmt->fourcc == f->fmt.pix_mp.pixelformat) {
+		if (fmt->fourcc == f->fmt.pix_mp.pixelformat &&
+		    fe_format_find(fmt->drm_fourcc, types)) {
 			break;
 		}
 	}
@@ -180,6 +355,89 @@ static struct sunxi_de_fe_fmt *find_format(struct v4l2_format *f)
 	return &formats[k];
 }
 
+static int sunxi_de_fe_s_ctrl(struct v4l2_ctrl *ctrl)
+{
+	struct sunxi_de_fe_ctx *ctx;
+
+	ctx = container_of(ctrl->handler, struct sunxi_de_fe_ctx, hdl);
+	PRINT_DE_FE("de_fe %s();\n", __FUNCTION__);
+
+	switch (ctrl->id) {
+	case SUNXI_FE_CID_BATCH_SIZE:
+		ctx->batch_size = ctrl->val;
+		break;
+	case SUNXI_FE_CID_DIRECT_OUTPUT:
+		ctx->direct = ctrl->val;
+		break;
+	case SUNXI_FE_CID_FANOUT_GROUP:
+		mutex_lock(&ctx->node->job_lock);
+		ctx->fanout_group = ctrl->val;
+		list_del_init(&ctx->fanout_entry);
+		if (ctx->fanout_group)
+			list_add_tail(&ctx->fanout_entry,
+			    &ctx->node->fanout_list);
+		mutex_unlock(&ctx->node->job_lock);
+		break;
+	default:
+		return -EINVAL;
+	}
+	return 0;
+}
+
+static const struct v4l2_ctrl_ops sunxi_de_fe_ctrl_ops = {
+	.s_ctrl = sunxi_de_fe_s_ctrl,
+};
+
+/*
+ * Number of frames processed by one m2m job. Larger batches save scheduling
+ * overhead for throughput oriented use, at the cost of latency.
+ */
+static const struct v4l2_ctrl_config sunxi_de_fe_ctrl_batch_size = {
+	.ops	= &sunxi_de_fe_ctrl_ops,
+	.id	= SUNXI_FE_CID_BATCH_SIZE,
+	.name	= "Frames Per Job",
+	.type	= V4L2_CTRL_TYPE_INTEGER,
+	.def	= 1,
+	.min	= 1,
+	.max	= SUNXI_FE_MAX_BATCH_SIZE,
+	.step	= 1,
+};
+
+/*
+ * Sends the frames of a context straight to the back-end instead of writing
+ * them back to memory, which saves the write and the read back by the
+ * display. Destination buffers are still needed to schedule jobs, they are
+ * returned empty.
+ */
+static const struct v4l2_ctrl_config sunxi_de_fe_ctrl_direct_output = {
+	.ops	= &sunxi_de_fe_ctrl_ops,
+	.id	= SUNXI_FE_CID_DIRECT_OUTPUT,
+	.name	= "Direct To Back-End",
+	.type	= V4L2_CTRL_TYPE_BOOLEAN,
+	.def	= 0,
+	.min	= 0,
+	.max	= 1,
+	.step	= 1,
+};
+
+/*
+ * Contexts of the same fan-out group share their source frames. A context
+ * without an OUTPUT format only streams CAPTURE and gets each source frame of
+ * the group scaled to its own format, within the job of the source. That
+ * saves queueing the source once for every output, and the switches between
+ * the jobs.
+ */
+static const struct v4l2_ctrl_config sunxi_de_fe_ctrl_fanout_group = {
+	.ops	= &sunxi_de_fe_ctrl_ops,
+	.id	= SUNXI_FE_CID_FANOUT_GROUP,
+	.name	= "Fan-Out Group",
+	.type	= V4L2_CTRL_TYPE_INTEGER,
+	.def	= 0,
+	.min	= 0,
+	.max	= SUNXI_FE_MAX_FANOUT_GROUP,
+	.step	= 1,
+};
+
 static inline struct sunxi_de_fe_ctx *file2ctx(struct file *file)
 {
 
@@ -190,8 +448,6 @@ static inline struct sunxi_de_fe_ctx *file2ctx(struct file *file)
 static int vidioc_s_fmt(struct sunxi_de_fe_ctx *ctx, struct v4l2_format *f)
 {
 	struct v4l2_pix_format_mplane *pix_fmt_mp;
-	struct sunxi_de_fe_fmt *fmt;
-	int i;
 
 	pix_fmt_mp = &f->fmt.pix_mp;
 
@@ -202,21 +458,16 @@ static int vidioc_s_fmt(struct sunxi_de_fe_ctx *ctx, struct v4l2_format *f)
 
 	switch (f->type) {
 	case V4L2_BUF_TYPE_VIDEO_OUTPUT_MPLANE:
-		ctx->vpu_src_fmt = find_format(f);
+		ctx->vpu_src_fmt = find_format(f, SUNXI_DE_FE_OUTPUT);
 		ctx->src_fmt = *pix_fmt_mp;
+		/* A new frame size drops the crop. */
+		memset(&ctx->cfg.crop, 0, sizeof(ctx->cfg.crop));
 		break;
 	case V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE:
-		fmt = find_format(f);
-		ctx->vpu_dst_fmt = fmt;
-
-		for (i = 0; i < fmt->num_planes; ++i) {
-			pix_fmt_mp->plane_fmt[i].bytesperline =
-			    pix_fmt_mp->width * fmt->depth;
-			pix_fmt_mp->plane_fmt[i].sizeimage =
-			    pix_fmt_mp->plane_fmt[i].bytesperline *
-			    pix_fmt_mp->height;
-		}
+		ctx->vpu_dst_fmt = find_format(f, SUNXI_DE_FE_CAPTURE);
 		ctx->dst_fmt = *pix_fmt_mp;
+		/* A new frame size drops the compose rectangle. */
+		memset(&ctx->cfg.compose, 0, sizeof(ctx->cfg.compose));
 		break;
 	default:
 		PRINT_DE_FE("Frontend: invalid buf type\n");
@@ -226,10 +477,6 @@ static int vidioc_s_fmt(struct sunxi_de_fe_ctx *ctx, struct v4l2_format *f)
 	printk("Frontend output format is %dx%d.\n", pix_fmt_mp->width,
 	    pix_fmt_mp->height);
 
-#ifdef HACK_BACKEND_LAYER2_TO_FRONTEND
-	hack_enable_be0_layer2_to_fe(pix_fmt_mp->width, pix_fmt_mp->height);
-#endif
-
 	return 0;
 }
 
@@ -244,8 +491,7 @@ static int enum_fmt(struct v4l2_fmtdesc *f, u32 type)
 	PRINT_DE_FE("de_fe Looking for format %d\n", type);
 	PRINT_DE_FE("de_fe The following formats are supported:");
 	for (i = 0; i < NUM_FORMATS; ++i) {
-		PRINT_DE_FE("de_fe , %d", formats[i].types);
-		if (formats[i].types & type) {
+		if (fe_format_find(formats[i].drm_fourcc, type)) {
 			PRINT_DE_FE("de_fe (type match) f->index = %d",
 			    f->index);
 			/* index-th format of type type found ? */
@@ -322,34 +568,68 @@ static int vidioc_g_fmt_vid_cap(struct file *file, void *priv,
 	return vidioc_g_fmt(file2ctx(file), f);
 }
 
+/*
+ * sunxi_fe_field() - returns the FE_GEO_FIELD_* layout of a V4L2 field order
+ */
+static unsigned int sunxi_fe_field(enum v4l2_field field)
+{
+
+	switch (field) {
+	case V4L2_FIELD_INTERLACED:
+	case V4L2_FIELD_INTERLACED_TB:
+		return FE_GEO_FIELD_INTERLACED;
+	case V4L2_FIELD_SEQ_TB:
+		return FE_GEO_FIELD_SEQ;
+	default:
+		return FE_GEO_FIELD_NONE;
+	}
+}
+
 static int vidioc_try_fmt(struct v4l2_format *f, struct sunxi_de_fe_fmt *fmt)
 {
-	int i;
-	__u32 bpl;
+	uint32_t pitch[FE_GEO_MAX_PLANES], size[FE_GEO_MAX_PLANES];
+	const struct fe_format *format;
+	int i, ret;
 
 	PRINT_DE_FE("de_fe %s();\n", __FUNCTION__);
 
-	f->fmt.pix_mp.field = V4L2_FIELD_NONE;
-	f->fmt.pix_mp.num_planes = fmt->num_planes;
+	/*
+	 * Every field of an interlaced source is scaled to a progressive
+	 * capture frame. Both fields hold whole chroma lines; tiled input
+	 * can only be read progressively.
+	 */
+	format = fe_format_find(fmt->drm_fourcc, 0);
+	if (!format)
+		return -EINVAL;
 
-	switch (f->type) {
-	case V4L2_BUF_TYPE_VIDEO_OUTPUT_MPLANE:
-		// if (f->fmt.pix_mp.plane_fmt[0].sizeimage == 0)
-		// 	return -EINVAL;
+	/* Wider frames are scaled in stripes, see fe_geometry_plan(). */
+	f->fmt.pix_mp.width = clamp_t(uint32_t, f->fmt.pix_mp.width,
+	    FE_GEO_MIN_SIZE, FE_GEO_MAX_SIZE);
+	f->fmt.pix_mp.height = clamp_t(uint32_t, f->fmt.pix_mp.height,
+	    FE_GEO_MIN_SIZE, FE_GEO_MAX_SIZE);
+
+	if (!V4L2_TYPE_IS_OUTPUT(f->type) || format->tiled ||
+	    sunxi_fe_field(f->fmt.pix_mp.field) == FE_GEO_FIELD_NONE)
+		f->fmt.pix_mp.field = V4L2_FIELD_NONE;
+	else
+		f->fmt.pix_mp.height = roundup(f->fmt.pix_mp.height,
+		    FE_GEO_NR_FIELDS * format->vsub);
+	f->fmt.pix_mp.num_planes = fmt->num_planes;
 
-		// f->fmt.pix_mp.plane_fmt[0].bytesperline = 0;
-		// break;
+	/*
+	 * Chroma planes have a pitch and size of their own. A capture frame
+	 * may have longer lines, to compose into a part of a larger buffer.
+	 */
+	pitch[0] = V4L2_TYPE_IS_OUTPUT(f->type) ? 0 :
+	    f->fmt.pix_mp.plane_fmt[0].bytesperline;
+	ret = fe_geometry_buffers(fmt->drm_fourcc, fmt->num_planes,
+	    f->fmt.pix_mp.width, f->fmt.pix_mp.height, pitch, size);
+	if (ret != fmt->num_planes)
+		return -EINVAL;
 
-		/* FALL THROUGH */
-	case V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE:
-		//TODO: come back and check this loop Thomas
-		for (i = 0; i < f->fmt.pix_mp.num_planes; ++i) {
-			bpl = (f->fmt.pix_mp.width * fmt->depth) >> 3;
-			f->fmt.pix_mp.plane_fmt[i].bytesperline = bpl;
-			f->fmt.pix_mp.plane_fmt[i].sizeimage =
-				f->fmt.pix_mp.height * bpl;
-		}
-		break;
+	for (i = 0; i < ret; ++i) {
+		f->fmt.pix_mp.plane_fmt[i].bytesperline = pitch[i];
+		f->fmt.pix_mp.plane_fmt[i].sizeimage = size[i];
 	}
 	return 0;
 }
@@ -363,10 +643,10 @@ static int vidioc_try_fmt_vid_cap(struct file *file, void *priv,
 	ctx = file2ctx(file);
 	PRINT_DE_FE("de_fe %s();\n", __FUNCTION__);
 
-	fmt = find_format(f);
+	fmt = find_format(f, SUNXI_DE_FE_CAPTURE);
 	if (!fmt) {
-		f->fmt.pix_mp.pixelformat = formats[0].fourcc;
-		fmt = find_format(f);
+		f->fmt.pix_mp.pixelformat = V4L2_PIX_FMT_XBGR32;
+		fmt = find_format(f, SUNXI_DE_FE_CAPTURE);
 	}
 	return vidioc_try_fmt(f, fmt);
 }
@@ -388,7 +668,7 @@ static int vidioc_enum_fmt_vid_out(struct file *file, void *priv,
 {
 
 	PRINT_DE_FE("de_fe %s();\n", __FUNCTION__);
-	return 0;
+	return enum_fmt(f, SUNXI_DE_FE_OUTPUT);
 }
 
 
@@ -407,15 +687,10 @@ static int vidioc_try_fmt_vid_out(struct file *file, void *priv,
 	struct sunxi_de_fe_fmt *fmt;
 
 	PRINT_DE_FE("de_fe %s();\n", __FUNCTION__);
-	fmt = find_format(f);
+	fmt = find_format(f, SUNXI_DE_FE_OUTPUT);
 	if (!fmt) {
 		f->fmt.pix_mp.pixelformat = formats[0].fourcc;
-		fmt = find_format(f);
-	}
-	if (!(fmt->types & SUNXI_DE_FE_OUTPUT)) {
-		PRINT_DE_FE("Frontend: Fourcc format (0x%08x) invalid.\n",
-		    f->fmt.pix_mp.pixelformat);
-		return -EINVAL;
+		fmt = find_format(f, SUNXI_DE_FE_OUTPUT);
 	}
 
 	return vidioc_try_fmt(f, fmt);
@@ -439,136 +714,1634 @@ static int vidioc_s_fmt_vid_out(struct file *file, void *priv,
 }
 
 /*
- * device_run() - prepares and starts processing
+ * sunxi_fe_fanout_target() - whether ctx is a fan-out target
+ *
+ * A target has no source of its own. Called with job_lock held.
  */
-static void device_run(void *priv)
+static bool sunxi_fe_fanout_target(struct sunxi_de_fe_ctx *ctx)
 {
-	struct sunxi_de_fe_ctx *ctx;
-	struct sunxi_de_fe_ctx *curr_ctx;
-	struct vb2_v4l2_buffer *in_vb, *out_vb;
-	dma_addr_t in_luma, in_chroma, out_luma, out_chroma;
-	int ret;
-
-	ctx = priv;
-	PRINT_DE_FE("de_fe %s();\n", __FUNCTION__);
 
-	in_vb = v4l2_m2m_next_src_buf(ctx->fh.m2m_ctx);
-	out_vb = v4l2_m2m_next_dst_buf(ctx->fh.m2m_ctx);
+	return ctx->fanout_group && !ctx->vpu_src_fmt;
+}
 
-	in_luma = vb2_dma_contig_plane_dma_addr(&in_vb->vb2_buf, 0);
-	in_chroma = vb2_dma_contig_plane_dma_addr(&in_vb->vb2_buf, 1);
+/*
+ * sunxi_fe_ctx_next_cfg() - conversion the next frames of ctx are made with
+ */
+static struct sunxi_fe_config *sunxi_fe_ctx_next_cfg(
+    struct sunxi_de_fe_ctx *ctx)
+{
 
-	out_luma = vb2_dma_contig_plane_dma_addr(&out_vb->vb2_buf, 0);
-	out_chroma = vb2_dma_contig_plane_dma_addr(&out_vb->vb2_buf, 1);
+	return ctx->pending ? &ctx->pending_cfg : &ctx->cfg;
+}
 
-	 // Luma is Y, chroma is color UV.
-	in_luma -= PHYS_OFFSET;
-	in_chroma -= PHYS_OFFSET;
-	out_luma -= PHYS_OFFSET;
-	out_chroma -= PHYS_OFFSET;
+/*
+ * sunxi_fe_ctx_rate() - module clock rate that keeps up with ctx
+ *
+ * Each field of an interlaced source is scaled to a whole output frame. A
+ * context without a frame interval, such as a batch of thumbnails, or one
+ * that feeds the back-end is converted as fast as possible. Called with
+ * job_lock held.
+ */
+static unsigned long sunxi_fe_ctx_rate(struct sunxi_de_fe_ctx *ctx)
+{
+	const struct sunxi_fe_config *cfg = sunxi_fe_ctx_next_cfg(ctx);
+	u64 in_pixels, out_pixels, rate;
+
+	if (ctx->direct || !ctx->timeperframe.numerator ||
+	    !ctx->timeperframe.denominator)
+		return SUNXI_FE_MAX_MOD_RATE;
+
+	if (cfg->crop.width)
+		in_pixels = (u64)cfg->crop.width * cfg->crop.height;
+	else
+		in_pixels = (u64)cfg->in_width * cfg->in_height;
+	if (cfg->compose.width)
+		out_pixels = (u64)cfg->compose.width * cfg->compose.height;
+	else
+		out_pixels = (u64)cfg->out_width * cfg->out_height;
+	if (cfg->field != FE_GEO_FIELD_NONE)
+		out_pixels *= FE_GEO_NR_FIELDS;
+
+	rate = max(in_pixels, out_pixels) * ctx->timeperframe.denominator;
+	rate = min_t(u64, div_u64(rate, ctx->timeperframe.numerator),
+	    SUNXI_FE_MAX_MOD_RATE);
+	rate += div_u64(rate * SUNXI_FE_RATE_HEADROOM, 100);
+
+	return min_t(u64, rate, SUNXI_FE_MAX_MOD_RATE);
+}
 
-	PRINT_DE_FE("de fe: in_luma = 0x%x\n", in_luma);
-	PRINT_DE_FE("de fe: in_chroma = 0x%x\n", in_chroma);
-	PRINT_DE_FE("de fe: out_luma = 0x%x\n", out_luma);
-	PRINT_DE_FE("de fe: out_chroma = 0x%x\n", out_chroma);
+/*
+ * sunxi_fe_core_set_rate() - sets the module clock of dev to at least rate
+ *
+ * The clock is divided down from its parent, so the rates it can take are
+ * walked down from the highest one to the lowest that is not below rate.
+ * Called with job_lock held.
+ */
+static void sunxi_fe_core_set_rate(struct sunxi_fe_device *dev,
+    unsigned long rate)
+{
+	long best, next;
 
-	//TODO: Get this from a GEM/DMA_BUF buffer handle
-	ret = regmap_write(sunxi_fe_dev->regs, DEFE_BUF_ADDR0_REG, in_luma);
-	if (ret == -EIO)
-		printk("Could not set y input addr.\n");
+	best = clk_round_rate(dev->mod_clk, SUNXI_FE_MAX_MOD_RATE);
+	if (best <= 0)
+		return;
 
-	ret = regmap_write(sunxi_fe_dev->regs, DEFE_BUF_ADDR1_REG,
-	    in_chroma);
-	if (ret == -EIO)
-		printk("Could not set uv input addr.\n");
+	while ((unsigned long)best > rate) {
+		next = clk_round_rate(dev->mod_clk, best - 1);
+		if (next <= 0 || next >= best || (unsigned long)next < rate)
+			break;
+		best = next;
+	}
+	if (best == dev->mod_rate)
+		return;
 
-	if (regmap_update_bits(sunxi_fe_dev->regs, DEFE_FRM_CTRL_REG,
-	    DEFE_REG_RDY_MASK | DEFE_FRM_START_START_MASK,
-	    DEFE_REG_RDY_EN(ENABLE) | DEFE_FRM_START_BIT(ENABLE))) {
-		printk("Could not start frontend.\n");
+	if (clk_set_rate(dev->mod_clk, best)) {
+		printk("Frontend: could not set the clock of %s to %ld Hz\n",
+		    dev->phys_name, best);
 		return;
 	}
-
-	curr_ctx = v4l2_m2m_get_curr_priv(ctx->dev->m2m_dev);
-
-	// The following v4l2 calls should go to an irq done.
-	in_vb = v4l2_m2m_src_buf_remove(ctx->fh.m2m_ctx);
-	out_vb = v4l2_m2m_dst_buf_remove(ctx->fh.m2m_ctx);
-
-	v4l2_m2m_buf_done(in_vb, VB2_BUF_STATE_DONE);
-	v4l2_m2m_buf_done(out_vb, VB2_BUF_STATE_DONE);
-	v4l2_m2m_job_finish(ctx->dev->m2m_dev, curr_ctx->fh.m2m_ctx);
+	dev->mod_rate = best;
+	PRINT_DE_FE("de_fe %s clocked at %ld Hz\n", dev->phys_name, best);
 }
 
-static void job_abort(void *priv)
+/*
+ * sunxi_fe_node_set_rate() - clocks the front-ends of node for its streams
+ *
+ * The frames of a context run on one front-end at a time, those of different
+ * contexts are spread over all of them. Without streaming contexts the
+ * front-ends run at the full rate, as the misc device expects. Called with
+ * job_lock held.
+ */
+static void sunxi_fe_node_set_rate(struct sunxi_fe_node *node)
 {
+	struct sunxi_de_fe_ctx *ctx;
+	unsigned long rate, peak = 0, total = 0;
+	unsigned int i;
+
+	list_for_each_entry(ctx, &node->stream_list, stream_entry) {
+		rate = sunxi_fe_ctx_rate(ctx);
+		peak = max(peak, rate);
+		total = min_t(unsigned long, total + rate,
+		    SUNXI_FE_MAX_MOD_RATE * SUNXI_FE_MAX_CORES);
+	}
 
-	PRINT_DE_FE("de_fe %s();\n", __FUNCTION__);
-	/* Maybe move stuff from the release to here? */
-	printk("Frontend job_abort :D \n");
+	if (list_empty(&node->stream_list))
+		rate = SUNXI_FE_MAX_MOD_RATE;
+	else
+		rate = max(peak, DIV_ROUND_UP(total, node->nr_cores));
+	rate = clamp_t(unsigned long, rate, SUNXI_FE_MIN_MOD_RATE,
+	    SUNXI_FE_MAX_MOD_RATE);
+
+	for (i = 0; i < node->nr_cores; i++)
+		sunxi_fe_core_set_rate(node->cores[i], rate);
 }
 
 /*
- * The noop_llseek() is an llseek() operation that filesystems can use that
- * don't want to support seeking (leave the file->f_pos untouched) but still
- * want to let the syscall itself to succeed.
+ * sunxi_fe_ctx_rebuild() - applies a changed conversion to a context
  *
- * [PATCH 01/15] Introduce noop_llseek()
- * http://www.spinics.net/lists/linux-fsdevel/msg28104.html
+ * Called with job_lock held. While streaming, the next frame uses the new
+ * registers. A frame whose stripes or fan-out targets are partly staged is
+ * finished with the old ones, the new conversion is kept pending until then.
+ * The context keeps its old conversion if the new one is not supported.
  */
-static const struct file_operations sunxi_fe_fops = {
-	.owner		= THIS_MODULE,
-	.unlocked_ioctl	= &sunxi_fe_ioctl,
-	.write		= proc_sunxi_de_fe_write,
-	.llseek		= noop_llseek,
-};
+static int sunxi_fe_ctx_rebuild(struct sunxi_de_fe_ctx *ctx,
+    struct sunxi_fe_config *cfg)
+{
+	struct fe_reg_image *img;
+	struct fe_geometry geo;
+	int ret;
 
-static const struct v4l2_file_operations sunxi_fe_v4l2_fops = {
-	.owner		= THIS_MODULE,
-	.open		= sunxi_fe_open,
-	.release	= sunxi_fe_release,
-	.poll		= v4l2_m2m_fop_poll,
-	.unlocked_ioctl	= video_ioctl2,
-	.mmap		= v4l2_m2m_fop_mmap,
-};
+	if (!vb2_is_streaming(v4l2_m2m_get_src_vq(ctx->fh.m2m_ctx)) &&
+	    !vb2_is_streaming(v4l2_m2m_get_dst_vq(ctx->fh.m2m_ctx))) {
+		ctx->cfg = *cfg;
+		return 0;
+	}
 
-/*
- * Disabled some ioc as this driver will handle preallocated buffers by the
- * cedrus driver.
- */
-static const struct v4l2_ioctl_ops sunxi_fe_v4l2_ioctl_ops = {
-	.vidioc_querycap			= vidioc_querycap,
+	/* A fan-out target is rebuilt once it knows its next source. */
+	if (sunxi_fe_fanout_target(ctx)) {
+		ctx->cfg = *cfg;
+		ctx->fanout_dirty = true;
+		sunxi_fe_node_set_rate(ctx->node);
+		return 0;
+	}
 
-	.vidioc_enum_fmt_vid_cap	= vidioc_enum_fmt_vid_cap,
-	.vidioc_g_fmt_vid_cap_mplane	= vidioc_g_fmt_vid_cap,
-	.vidioc_try_fmt_vid_cap_mplane	= vidioc_try_fmt_vid_cap,
-	.vidioc_s_fmt_vid_cap_mplane	= vidioc_s_fmt_vid_cap,
+	img = kmalloc(sizeof(ctx->regs), GFP_KERNEL);
+	if (!img)
+		return -ENOMEM;
 
-	.vidioc_enum_fmt_vid_out_mplane = vidioc_enum_fmt_vid_out,
-	.vidioc_g_fmt_vid_out_mplane	= vidioc_g_fmt_vid_out,
-	.vidioc_try_fmt_vid_out_mplane	= vidioc_try_fmt_vid_out,
-	.vidioc_s_fmt_vid_out_mplane	= vidioc_s_fmt_vid_out,
+	ret = sunxi_fe_build_regs(cfg, &geo, img, ctx->direct ? 1 :
+	    ARRAY_SIZE(ctx->regs)) ? -EINVAL : 0;
+	if (!ret && (ctx->stripe || ctx->target)) {
+		ctx->pending_cfg = *cfg;
+		ctx->pending_geo = geo;
+		memcpy(ctx->pending_regs, img, sizeof(ctx->pending_regs));
+		ctx->pending = true;
+	} else if (!ret) {
+		ctx->cfg = *cfg;
+		ctx->geo = geo;
+		memcpy(ctx->regs, img, sizeof(ctx->regs));
+		ctx->pending = false;
+	}
+	if (!ret)
+		sunxi_fe_node_set_rate(ctx->node);
+	kfree(img);
 
-	.vidioc_reqbufs		= v4l2_m2m_ioctl_reqbufs,
-	.vidioc_querybuf	= v4l2_m2m_ioctl_querybuf,
-	.vidioc_prepare_buf	= v4l2_m2m_ioctl_prepare_buf,
-	.vidioc_create_bufs	= v4l2_m2m_ioctl_create_bufs,
-	.vidioc_expbuf		= v4l2_m2m_ioctl_expbuf,
+	return ret;
+}
 
-	.vidioc_qbuf		= v4l2_m2m_ioctl_qbuf,
-	.vidioc_dqbuf		= v4l2_m2m_ioctl_dqbuf,
+static void sunxi_fe_full_rect(uint32_t width, uint32_t height,
+    struct v4l2_rect *r)
+{
 
-	.vidioc_streamon	= v4l2_m2m_ioctl_streamon,
-	.vidioc_streamoff	= v4l2_m2m_ioctl_streamoff,
-};
+	r->left = 0;
+	r->top = 0;
+	r->width = width;
+	r->height = height;
+}
 
-static struct v4l2_m2m_ops m2m_ops = {
-	.device_run	= device_run,
-	.job_abort	= job_abort,
-};
+static int vidioc_g_selection(struct file *file, void *priv,
+    struct v4l2_selection *s)
+{
+	struct sunxi_de_fe_ctx *ctx = file2ctx(file);
+	struct fe_rect *rect;
 
-/* This replaces the platform device. */
-static struct video_device sunxi_de_fe_viddev = {
+	PRINT_DE_FE("de_fe %s();\n", __FUNCTION__);
+	if (V4L2_TYPE_IS_OUTPUT(s->type)) {
+		rect = &sunxi_fe_ctx_next_cfg(ctx)->crop;
+		switch (s->target) {
+		case V4L2_SEL_TGT_CROP:
+			if (rect->width && rect->height)
+				break;
+			/* FALL THROUGH */
+		case V4L2_SEL_TGT_CROP_DEFAULT:
+		case V4L2_SEL_TGT_CROP_BOUNDS:
+			sunxi_fe_full_rect(ctx->src_fmt.width,
+			    ctx->src_fmt.height, &s->r);
+			return 0;
+		default:
+			return -EINVAL;
+		}
+	} else {
+		rect = &sunxi_fe_ctx_next_cfg(ctx)->compose;
+		switch (s->target) {
+		case V4L2_SEL_TGT_COMPOSE:
+			if (rect->width && rect->height)
+				break;
+			/* FALL THROUGH */
+		case V4L2_SEL_TGT_COMPOSE_DEFAULT:
+		case V4L2_SEL_TGT_COMPOSE_BOUNDS:
+			sunxi_fe_full_rect(ctx->dst_fmt.width,
+			    ctx->dst_fmt.height, &s->r);
+			return 0;
+		default:
+			return -EINVAL;
+		}
+	}
+
+	s->r.left = rect->left;
+	s->r.top = rect->top;
+	s->r.width = rect->width;
+	s->r.height = rect->height;
+	return 0;
+}
+
+/*
+ * The crop is done by the input dma channels, which start reading at the
+ * first pixel of the rectangle, so it costs no copy. The compose rectangle
+ * is done the same way by the write-back channels, which leave the rest of
+ * the capture frame untouched. Both may be changed while streaming to pan or
+ * zoom. The rectangles are aligned to whole chroma samples.
+ */
+static int vidioc_s_selection(struct file *file, void *priv,
+    struct v4l2_selection *s)
+{
+	struct sunxi_de_fe_ctx *ctx = file2ctx(file);
+	const struct fe_format *fmt;
+	struct sunxi_fe_config cfg;
+	struct fe_rect *rect;
+	uint32_t width, height, vsub, min_height;
+	int ret;
+
+	PRINT_DE_FE("de_fe %s();\n", __FUNCTION__);
+	if (V4L2_TYPE_IS_OUTPUT(s->type)) {
+		if (s->target != V4L2_SEL_TGT_CROP || !ctx->vpu_src_fmt)
+			return -EINVAL;
+
+		fmt = fe_format_find(ctx->vpu_src_fmt->drm_fourcc,
+		    FE_FORMAT_IN);
+		width = ctx->src_fmt.width;
+		height = ctx->src_fmt.height;
+	} else {
+		if (s->target != V4L2_SEL_TGT_COMPOSE || !ctx->vpu_dst_fmt)
+			return -EINVAL;
+
+		fmt = fe_format_find(ctx->vpu_dst_fmt->drm_fourcc,
+		    FE_FORMAT_OUT);
+		width = ctx->dst_fmt.width;
+		height = ctx->dst_fmt.height;
+	}
+	if (!fmt)
+		return -EINVAL;
+
+	/* A crop of field based input holds whole lines of both fields. */
+	vsub = fmt->vsub;
+	min_height = FE_GEO_MIN_SIZE;
+	if (V4L2_TYPE_IS_OUTPUT(s->type) &&
+	    sunxi_fe_field(ctx->src_fmt.field) != FE_GEO_FIELD_NONE) {
+		vsub *= FE_GEO_NR_FIELDS;
+		min_height *= FE_GEO_NR_FIELDS;
+	}
+	if (width < FE_GEO_MIN_SIZE || height < min_height)
+		return -EINVAL;
+
+	s->r.width = clamp_t(uint32_t, s->r.width, FE_GEO_MIN_SIZE, width);
+	s->r.height = clamp_t(uint32_t, s->r.height, min_height, height);
+	if (vsub != fmt->vsub)
+		s->r.height = rounddown(s->r.height, vsub);
+	s->r.left = clamp_t(int32_t, s->r.left, 0, width - s->r.width);
+	s->r.top = clamp_t(int32_t, s->r.top, 0, height - s->r.height);
+	s->r.left = rounddown(s->r.left, fmt->hsub);
+	s->r.top = rounddown(s->r.top, vsub);
+
+	mutex_lock(&ctx->node->job_lock);
+	cfg = *sunxi_fe_ctx_next_cfg(ctx);
+	rect = V4L2_TYPE_IS_OUTPUT(s->type) ? &cfg.crop : &cfg.compose;
+	rect->left = s->r.left;
+	rect->top = s->r.top;
+	rect->width = s->r.width;
+	rect->height = s->r.height;
+	ret = sunxi_fe_ctx_rebuild(ctx, &cfg);
+	mutex_unlock(&ctx->node->job_lock);
+
+	return ret;
+}
+
+/*
+ * The frame interval of either queue is that of the context: the time it has
+ * to convert a source frame. The module clock follows it, 0/0 asks for the
+ * full rate.
+ */
+static int vidioc_g_parm(struct file *file, void *priv,
+    struct v4l2_streamparm *parm)
+{
+	struct sunxi_de_fe_ctx *ctx = file2ctx(file);
+	struct v4l2_fract *tpf;
+
+	PRINT_DE_FE("de_fe %s();\n", __FUNCTION__);
+	if (parm->type == V4L2_BUF_TYPE_VIDEO_OUTPUT_MPLANE) {
+		memset(&parm->parm.output, 0, sizeof(parm->parm.output));
+		parm->parm.output.capability = V4L2_CAP_TIMEPERFRAME;
+		tpf = &parm->parm.output.timeperframe;
+	} else if (parm->type == V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE) {
+		memset(&parm->parm.capture, 0, sizeof(parm->parm.capture));
+		parm->parm.capture.capability = V4L2_CAP_TIMEPERFRAME;
+		tpf = &parm->parm.capture.timeperframe;
+	} else {
+		return -EINVAL;
+	}
+
+	mutex_lock(&ctx->node->job_lock);
+	*tpf = ctx->timeperframe;
+	mutex_unlock(&ctx->node->job_lock);
+
+	return 0;
+}
+
+static int vidioc_s_parm(struct file *file, void *priv,
+    struct v4l2_streamparm *parm)
+{
+	struct sunxi_de_fe_ctx *ctx = file2ctx(file);
+	struct v4l2_fract tpf;
+
+	PRINT_DE_FE("de_fe %s();\n", __FUNCTION__);
+	if (parm->type == V4L2_BUF_TYPE_VIDEO_OUTPUT_MPLANE)
+		tpf = parm->parm.output.timeperframe;
+	else if (parm->type == V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE)
+		tpf = parm->parm.capture.timeperframe;
+	else
+		return -EINVAL;
+
+	if (!tpf.numerator || !tpf.denominator) {
+		tpf.numerator = 0;
+		tpf.denominator = 0;
+	}
+
+	/* Raised before the next frame is staged. */
+	mutex_lock(&ctx->node->job_lock);
+	ctx->timeperframe = tpf;
+	if (ctx->nr_streaming)
+		sunxi_fe_node_set_rate(ctx->node);
+	mutex_unlock(&ctx->node->job_lock);
+
+	return vidioc_g_parm(file, priv, parm);
+}
+
+/*
+ * V4L2_DEC_CMD_STOP drains the context: the frames it has queued are run
+ * even if they do not fill a batch, then an empty capture buffer is returned
+ * with V4L2_BUF_FLAG_LAST and V4L2_EVENT_EOS is raised. V4L2_DEC_CMD_START
+ * resumes the context after the drain.
+ */
+static int vidioc_try_decoder_cmd(struct file *file, void *priv,
+    struct v4l2_decoder_cmd *cmd)
+{
+
+	switch (cmd->cmd) {
+	case V4L2_DEC_CMD_STOP:
+		cmd->stop.pts = 0;
+		break;
+	case V4L2_DEC_CMD_START:
+		cmd->start.speed = 0;
+		cmd->start.format = V4L2_DEC_START_FMT_NONE;
+		break;
+	default:
+		return -EINVAL;
+	}
+	cmd->flags = 0;
+
+	return 0;
+}
+
+static int vidioc_decoder_cmd(struct file *file, void *priv,
+    struct v4l2_decoder_cmd *cmd)
+{
+	struct sunxi_de_fe_ctx *ctx = file2ctx(file);
+	int ret;
+
+	PRINT_DE_FE("de_fe %s();\n", __FUNCTION__);
+	ret = vidioc_try_decoder_cmd(file, priv, cmd);
+	if (ret)
+		return ret;
+
+	mutex_lock(&ctx->node->job_lock);
+	if (cmd->cmd == V4L2_DEC_CMD_STOP) {
+		ctx->draining = true;
+		WRITE_ONCE(ctx->flush, true);
+		sunxi_fe_drain(ctx);
+	} else {
+		ctx->draining = false;
+		vb2_clear_last_buffer_dequeued(
+		    v4l2_m2m_get_dst_vq(ctx->fh.m2m_ctx));
+	}
+	mutex_unlock(&ctx->node->job_lock);
+
+	if (cmd->cmd == V4L2_DEC_CMD_STOP)
+		v4l2_m2m_try_schedule(ctx->fh.m2m_ctx);
+
+	return 0;
+}
+
+static int vidioc_subscribe_event(struct v4l2_fh *fh,
+    const struct v4l2_event_subscription *sub)
+{
+
+	switch (sub->type) {
+	case V4L2_EVENT_EOS:
+		return v4l2_event_subscribe(fh, sub, 2, NULL);
+	default:
+		return v4l2_ctrl_subscribe_event(fh, sub);
+	}
+}
+
+static const char *sunxi_fe_fence_get_driver_name(struct dma_fence *fence)
+{
+
+	return DRV_NAME;
+}
+
+static const char *sunxi_fe_fence_get_timeline_name(struct dma_fence *fence)
+{
+
+	return "write-back";
+}
+
+/* Fences are signalled from the irq thread, no need to enable anything. */
+static bool sunxi_fe_fence_enable_signaling(struct dma_fence *fence)
+{
+
+	return true;
+}
+
+static const struct dma_fence_ops sunxi_fe_fence_ops = {
+	.get_driver_name	= sunxi_fe_fence_get_driver_name,
+	.get_timeline_name	= sunxi_fe_fence_get_timeline_name,
+	.enable_signaling	= sunxi_fe_fence_enable_signaling,
+	.wait			= dma_fence_default_wait,
+};
+
+/*
+ * sunxi_fe_buf_done() - returns a buffer and signals its out-fence
+ *
+ * A buffer that was not written back signals its fence with an error, so
+ * that waiters never block on it.
+ */
+static void sunxi_fe_buf_done(struct vb2_v4l2_buffer *vbuf,
+    enum vb2_buffer_state state)
+{
+	struct sunxi_fe_buffer *buf;
+
+	buf = container_of(vbuf, struct sunxi_fe_buffer, m2m_buf.vb);
+	if (buf->out_fence) {
+		if (state != VB2_BUF_STATE_DONE)
+			dma_fence_set_error(buf->out_fence, -EIO);
+		dma_fence_signal(buf->out_fence);
+		dma_fence_put(buf->out_fence);
+		buf->out_fence = NULL;
+	}
+
+	v4l2_m2m_buf_done(vbuf, state);
+}
+
+/*
+ * sunxi_fe_buf_attach_fence() - fences a destination buffer until written back
+ *
+ * Called at QBUF. Each context has a timeline of its own, numbered in queue
+ * order; the destination buffers of a context are completed in that order and
+ * sunxi_fe_buf_done() signals the fence of each. The fence is added as
+ * exclusive fence to the dma-bufs of the buffer, so an importer such as the
+ * display waits for the write-back implicitly and the buffer can be passed on
+ * before it is dequeued.
+ */
+static void sunxi_fe_buf_attach_fence(struct sunxi_de_fe_ctx *ctx,
+    struct vb2_v4l2_buffer *vbuf)
+{
+	struct vb2_buffer *vb = &vbuf->vb2_buf;
+	struct reservation_object *resv;
+	struct sunxi_fe_buffer *buf;
+	struct dma_fence *fence;
+	unsigned long flags;
+	unsigned int i, seqno;
+
+	buf = container_of(vbuf, struct sunxi_fe_buffer, m2m_buf.vb);
+	if (vb->memory != VB2_MEMORY_DMABUF || buf->out_fence)
+		return;
+
+	fence = kzalloc(sizeof(*fence), GFP_KERNEL);
+	if (!fence)
+		return;
+
+	spin_lock_irqsave(&ctx->node->fence_lock, flags);
+	seqno = ++ctx->out_fence_seqno;
+	spin_unlock_irqrestore(&ctx->node->fence_lock, flags);
+
+	/* The lock lives in the node, the fence may outlive the context. */
+	dma_fence_init(fence, &sunxi_fe_fence_ops, &ctx->node->fence_lock,
+	    ctx->out_fence_context, seqno);
+
+	for (i = 0; i < vb->num_planes; i++) {
+		if (!vb->planes[i].dbuf)
+			continue;
+
+		resv = vb->planes[i].dbuf->resv;
+		reservation_object_lock(resv, NULL);
+		reservation_object_add_excl_fence(resv, fence);
+		reservation_object_unlock(resv);
+	}
+
+	buf->out_fence = fence;
+}
+
+static void sunxi_fe_frame_done(struct sunxi_fe_frame *frame,
+    enum vb2_buffer_state state)
+{
+	unsigned int i;
+
+	/* The buffers are returned with the last stripe, failed if one was. */
+	if (frame->keep_dst) {
+		if (state == VB2_BUF_STATE_ERROR)
+			frame->ctx->stripe_error = true;
+		return;
+	}
+	if (frame->ctx->stripe_error) {
+		frame->ctx->stripe_error = false;
+		state = VB2_BUF_STATE_ERROR;
+	}
+
+	/* Nothing was written to the destination of a direct frame. */
+	if (frame->direct)
+		for (i = 0; i < frame->dst->vb2_buf.num_planes; i++)
+			vb2_set_plane_payload(&frame->dst->vb2_buf, i, 0);
+
+	if (!frame->keep_src)
+		sunxi_fe_buf_done(frame->src, state);
+	sunxi_fe_buf_done(frame->dst, state);
+}
+
+/*
+ * sunxi_fe_frame_pending() - whether the hardware still owes an interrupt
+ *
+ * A direct frame that is shown without a successor is not waiting for
+ * anything. Called with irqlock held.
+ */
+static bool sunxi_fe_frame_pending(struct sunxi_fe_device *dev)
+{
+
+	return (dev->active.ctx && !dev->active.direct) || dev->staged.ctx;
+}
+
+/*
+ * sunxi_fe_frame_uses() - whether a frame slot holds buffers of ctx
+ *
+ * The frames of fan-out targets read the source buffer of another context.
+ */
+static bool sunxi_fe_frame_uses(const struct sunxi_fe_frame *frame,
+    const struct sunxi_de_fe_ctx *ctx)
+{
+
+	return frame->ctx && (frame->ctx == ctx || frame->src_ctx == ctx);
+}
+
+/*
+ * sunxi_fe_ctx_busy() - whether frames of ctx are still being processed
+ *
+ * The last direct frame of a context is shown until streaming stops, so it
+ * does not count, see sunxi_fe_direct_stop().
+ */
+static bool sunxi_fe_ctx_busy(struct sunxi_fe_device *dev,
+    struct sunxi_de_fe_ctx *ctx)
+{
+	unsigned long flags;
+	bool busy;
+
+	spin_lock_irqsave(&dev->irqlock, flags);
+	busy = (sunxi_fe_frame_uses(&dev->active, ctx) &&
+	    (!dev->active.direct || dev->staged.ctx)) ||
+	    sunxi_fe_frame_uses(&dev->staged, ctx) ||
+	    sunxi_fe_frame_uses(&dev->done, ctx);
+	spin_unlock_irqrestore(&dev->irqlock, flags);
+
+	return busy;
+}
+
+/*
+ * sunxi_fe_node_busy() - whether any front-end of node processes frames of ctx
+ */
+static bool sunxi_fe_node_busy(struct sunxi_fe_node *node,
+    struct sunxi_de_fe_ctx *ctx)
+{
+	unsigned int i;
+
+	for (i = 0; i < node->nr_cores; i++)
+		if (sunxi_fe_ctx_busy(node->cores[i], ctx))
+			return true;
+
+	return false;
+}
+
+/*
+ * sunxi_fe_drain() - ends the drain of ctx once its queued frames are done
+ *
+ * Nothing of ctx may be queued, waiting on a fence or in flight anymore. The
+ * next capture buffer is then returned empty with V4L2_BUF_FLAG_LAST, if none
+ * is queued yet the drain ends when one is. Called with job_lock held.
+ */
+static void sunxi_fe_drain(struct sunxi_de_fe_ctx *ctx)
+{
+	static const struct v4l2_event eos = { .type = V4L2_EVENT_EOS };
+	struct vb2_v4l2_buffer *dst;
+	unsigned int i;
+	bool fenced;
+
+	if (!ctx->draining || ctx->node->job_ctx == ctx ||
+	    v4l2_m2m_num_src_bufs_ready(ctx->fh.m2m_ctx) ||
+	    sunxi_fe_node_busy(ctx->node, ctx))
+		return;
+
+	spin_lock(&ctx->fence_lock);
+	fenced = !list_empty(&ctx->fence_list);
+	spin_unlock(&ctx->fence_lock);
+	if (fenced)
+		return;
+
+	dst = v4l2_m2m_dst_buf_remove(ctx->fh.m2m_ctx);
+	if (!dst)
+		return;
+
+	for (i = 0; i < dst->vb2_buf.num_planes; i++)
+		vb2_set_plane_payload(&dst->vb2_buf, i, 0);
+	dst->flags |= V4L2_BUF_FLAG_LAST;
+	ctx->draining = false;
+	sunxi_fe_buf_done(dst, VB2_BUF_STATE_DONE);
+	v4l2_event_queue_fh(&ctx->fh, &eos);
+}
+
+/*
+ * sunxi_fe_drain_node() - ends the drains the finished frames completed
+ *
+ * Called with job_lock held.
+ */
+static void sunxi_fe_drain_node(struct sunxi_fe_node *node)
+{
+	struct sunxi_de_fe_ctx *ctx;
+
+	list_for_each_entry(ctx, &node->stream_list, stream_entry)
+		sunxi_fe_drain(ctx);
+}
+
+/*
+ * sunxi_fe_kick() - starts the next frame
+ *
+ * The registers staged with REG_RDY are latched by the hardware at this frame
+ * start. Called with irqlock held, possibly from hard irq context.
+ */
+static void sunxi_fe_kick(struct sunxi_fe_device *dev)
+{
+
+	if (regmap_write_bits(dev->regs, DEFE_FRM_CTRL_REG,
+	    DEFE_FRM_START_START_MASK, DEFE_FRM_START_BIT(ENABLE)))
+		printk("Could not start frontend.\n");
+}
+
+static void sunxi_fe_coef_keys(const struct fe_reg_image *img,
+    uint32_t keys[DEFE_NR_COEF_CHANNELS][2])
+{
+
+	keys[0][FE_COEF_DIR_HORZ] = fe_coef_key(FE_COEF_DIR_HORZ,
+	    fe_reg_image_read(img, DEFE_CH0_HORZFACT_REG));
+	keys[0][FE_COEF_DIR_VERT] = fe_coef_key(FE_COEF_DIR_VERT,
+	    fe_reg_image_read(img, DEFE_CH0_VERTFACT_REG));
+	keys[1][FE_COEF_DIR_HORZ] = fe_coef_key(FE_COEF_DIR_HORZ,
+	    fe_reg_image_read(img, DEFE_CH1_HORZFACT_REG));
+	keys[1][FE_COEF_DIR_VERT] = fe_coef_key(FE_COEF_DIR_VERT,
+	    fe_reg_image_read(img, DEFE_CH1_VERTFACT_REG));
+}
+
+/*
+ * sunxi_fe_coef_changed() - whether img needs other scaler filters than loaded
+ *
+ * Called with job_lock held.
+ */
+static bool sunxi_fe_coef_changed(struct sunxi_fe_device *dev,
+    const struct fe_reg_image *img)
+{
+	uint32_t keys[DEFE_NR_COEF_CHANNELS][2];
+
+	sunxi_fe_coef_keys(img, keys);
+	return memcmp(keys, dev->coef_keys, sizeof(keys)) != 0;
+}
+
+/*
+ * sunxi_fe_load_coefs() - loads the scaler filters for the ratios of img
+ *
+ * The coefficient RAM is not double buffered, so this must only be called
+ * while no frame is being processed. Only banks of which the filter changed
+ * are written. Called with job_lock held.
+ */
+static int sunxi_fe_load_coefs(struct sunxi_fe_device *dev,
+    const struct fe_reg_image *img)
+{
+	uint32_t keys[DEFE_NR_COEF_CHANNELS][2];
+	const struct fe_coef_entry *entry;
+	bool changed = false;
+	int ch, dir, ret;
+
+	sunxi_fe_coef_keys(img, keys);
+
+	for (ch = 0; ch < DEFE_NR_COEF_CHANNELS; ch++) {
+		for (dir = 0; dir < 2; dir++) {
+			if (keys[ch][dir] == dev->coef_keys[ch][dir])
+				continue;
+
+			entry = fe_coef_cache_get(&dev->coef_cache,
+			    keys[ch][dir]);
+			if (!entry)
+				return -ENOMEM;
+
+			ret = fe_coef_upload_entry(dev->regs, ch, entry);
+			if (ret)
+				return ret;
+
+			dev->coef_keys[ch][dir] = keys[ch][dir];
+			changed = true;
+		}
+	}
+
+	if (!changed)
+		return 0;
+
+	return regmap_update_bits(dev->regs, DEFE_FRM_CTRL_REG,
+	    DEFE_COEF_RDY_MASK, DEFE_COEF_RDY_EN(ENABLE));
+}
+
+/*
+ * sunxi_fe_stage_field() - selects the field of an interlaced frame
+ *
+ * The hardware reads one field of interleaved lines by itself. Sequential
+ * fields are separate pictures, so only the phase of the bottom one is
+ * written. It is recorded in the hardware image, so the image of the next
+ * frame restores it.
+ */
+static int sunxi_fe_stage_field(struct sunxi_fe_device *dev,
+    const struct sunxi_fe_frame *frame)
+{
+	const struct fe_geometry *geo = &frame->ctx->geo;
+	uint32_t i, reg, val;
+	int ret;
+
+	if (geo->field == FE_GEO_FIELD_INTERLACED)
+		return regmap_write(dev->regs, DEFE_FIELD_CTRL_REG,
+		    DEFE_VALID_FIELD_CNT(0) | DEFE_FIELD_CNT(frame->field));
+
+	if (geo->field != FE_GEO_FIELD_SEQ || !frame->field)
+		return 0;
+
+	for (i = 0; i < FE_GEO_NR_CHANNELS; i++) {
+		reg = DEFE_CH0_VERTPHASE0_REG + i * IN_CHAN_INSIZE_OFFSET;
+		val = DEFE_CHX_PHASE(geo->chan[i].field_phase);
+
+		ret = regmap_write(dev->regs, reg, val);
+		if (ret)
+			return ret;
+
+		fe_reg_image_write(&dev->hw_regs, reg, val);
+	}
+
+	return 0;
+}
+
+/*
+ * sunxi_fe_stage_frame() - writes the registers of a frame to the shadow regs
+ *
+ * Called with job_lock held. The registers can be written while the previous
+ * frame is still being processed. Only the REG_RDY of the previous frame must
+ * have been consumed, else these values would be latched by the frame that is
+ * already running.
+ */
+static int sunxi_fe_stage_frame(struct sunxi_fe_device *dev,
+    struct sunxi_fe_frame *frame)
+{
+	const struct fe_geometry *geo = &frame->ctx->geo;
+	const struct fe_stripe_plan *stripe = &geo->stripe[frame->stripe];
+	dma_addr_t in_addr[FE_GEO_MAX_PLANES], out_addr[FE_GEO_MAX_PLANES];
+	unsigned int i, val;
+	int ret;
+
+	/*
+	 * The plane offsets select the plane within its buffer, the crop and
+	 * the stripe.
+	 */
+	for (i = 0; i < geo->nr_planes; i++) {
+		in_addr[i] = vb2_dma_contig_plane_dma_addr(&frame->src->vb2_buf,
+		    geo->plane[i].buffer) + stripe->in_offset[i];
+		if (frame->field)
+			in_addr[i] += geo->plane[i].field_offset;
+		in_addr[i] -= PHYS_OFFSET;
+		PRINT_DE_FE("de fe: in plane %u = 0x%x\n", i, in_addr[i]);
+	}
+	for (i = 0; i < geo->nr_out_planes; i++) {
+		out_addr[i] = vb2_dma_contig_plane_dma_addr(
+		    &frame->dst->vb2_buf, geo->out_plane[i].buffer) +
+		    stripe->out_offset[i];
+		out_addr[i] -= PHYS_OFFSET;
+		PRINT_DE_FE("de fe: out plane %u = 0x%x\n", i, out_addr[i]);
+	}
+
+	ret = regmap_read_poll_timeout(dev->regs, DEFE_FRM_CTRL_REG, val,
+	    !(val & DEFE_REG_RDY_MASK), SUNXI_FE_REG_RDY_POLL_US,
+	    SUNXI_FE_REG_RDY_TIMEOUT_US);
+	if (ret) {
+		printk("Frontend: previous registers were never latched.\n");
+		return ret;
+	}
+
+	/* Only the registers that differ from the previous frame. */
+	ret = fe_reg_image_apply(dev->regs, &frame->ctx->regs[frame->stripe],
+	    &dev->hw_regs);
+	if (ret < 0) {
+		printk("Could not set context registers.\n");
+		return ret;
+	}
+
+	ret = sunxi_fe_stage_field(dev, frame);
+	if (ret) {
+		printk("Could not select the field.\n");
+		return ret;
+	}
+
+	for (i = 0; i < geo->nr_planes; i++) {
+		ret = regmap_write(dev->regs, DEFE_BUF_ADDR0_REG +
+		    geo->plane[i].idma * IN_CHAN_ADDR_OFFSET, in_addr[i]);
+		if (ret == -EIO) {
+			printk("Could not set input addr of plane %u.\n", i);
+			return ret;
+		}
+	}
+
+	if (frame->direct) {
+		/* The latch of this frame retires the frame shown now. */
+		ret = regmap_update_bits(dev->regs, DEFE_INT_EN_REG,
+		    DEFE_REG_LOAD_INT_EN_MASK, DEFE_REG_LOAD_INT_EN(ENABLE));
+		if (ret)
+			return ret;
+
+		return regmap_update_bits(dev->regs, DEFE_FRM_CTRL_REG,
+		    DEFE_REG_RDY_MASK | DEFE_WB_EN_MASK | DEFE_OUT_CTRL_MASK,
+		    DEFE_REG_RDY_EN(ENABLE) | DEFE_WB_EN(DISABLE) |
+		    DEFE_OUT_CTRL(DEFE_OUT_CTRL_BE_EN));
+	}
+
+	/* Interleaved RGB only uses write-back channel 0. */
+	for (i = 0; i < geo->nr_out_planes; i++) {
+		ret = regmap_write(dev->regs, DEFE_WB_ADDR0_REG +
+		    geo->out_plane[i].idma * IN_CHAN_ADDR_OFFSET, out_addr[i]);
+		if (ret == -EIO) {
+			printk("Could not set write-back addr of plane %u.\n",
+			    i);
+			return ret;
+		}
+	}
+
+	return regmap_update_bits(dev->regs, DEFE_FRM_CTRL_REG,
+	    DEFE_REG_RDY_MASK | DEFE_WB_EN_MASK,
+	    DEFE_REG_RDY_EN(ENABLE) | DEFE_WB_EN(ENABLE));
+}
+
+/*
+ * sunxi_fe_direct_stop() - retires the direct frame ctx left on the screen
+ *
+ * Called once the context has no other frames in flight.
+ */
+static void sunxi_fe_direct_stop(struct sunxi_fe_device *dev,
+    struct sunxi_de_fe_ctx *ctx)
+{
+	struct sunxi_fe_frame frame = {};
+	unsigned long flags;
+
+	spin_lock_irqsave(&dev->irqlock, flags);
+	if (dev->active.ctx == ctx && dev->active.direct && !dev->staged.ctx) {
+		frame = dev->active;
+		dev->active.ctx = NULL;
+	}
+	spin_unlock_irqrestore(&dev->irqlock, flags);
+
+	if (!frame.ctx)
+		return;
+
+	mutex_lock(&dev->node->job_lock);
+	regmap_update_bits(dev->regs, DEFE_INT_EN_REG,
+	    DEFE_REG_LOAD_INT_EN_MASK, DEFE_REG_LOAD_INT_EN(DISABLE));
+	regmap_update_bits(dev->regs, DEFE_FRM_CTRL_REG, DEFE_OUT_CTRL_MASK,
+	    DEFE_OUT_CTRL(DEFE_OUT_CTRL_BE_DIS));
+	mutex_unlock(&dev->node->job_lock);
+
+	sunxi_fe_frame_done(&frame, VB2_BUF_STATE_DONE);
+	wake_up(&dev->node->frame_wq);
+
+	/* Frames of other contexts may have waited for the hardware. */
+	sunxi_fe_stage_next(dev->node);
+}
+
+/*
+ * sunxi_fe_reset() - resets the front-end and restores its registers
+ *
+ * All registers but the volatile ones are restored from the register cache
+ * in one pass, including the scaler coefficients, so the values in hw_regs
+ * remain valid. Called with job_lock held.
+ */
+static int sunxi_fe_reset(struct sunxi_fe_device *dev)
+{
+	int ret;
+
+	ret = reset_control_assert(dev->reset);
+	if (ret)
+		return ret;
+
+	ret = reset_control_deassert(dev->reset);
+	if (ret)
+		return ret;
+
+	ret = sunxi_fe_sync_regs(dev);
+	if (ret)
+		printk("Frontend: could not restore registers after reset\n");
+
+	return ret;
+}
+
+static void sunxi_fe_watchdog(struct work_struct *work)
+{
+	struct sunxi_fe_device *dev;
+	struct sunxi_fe_frame active, staged;
+	unsigned long flags;
+
+	dev = container_of(to_delayed_work(work), struct sunxi_fe_device,
+	    watchdog_work);
+
+	spin_lock_irqsave(&dev->irqlock, flags);
+	active = dev->active;
+	staged = dev->staged;
+	dev->active.ctx = NULL;
+	dev->staged.ctx = NULL;
+	spin_unlock_irqrestore(&dev->irqlock, flags);
+
+	if (!active.ctx)
+		return;
+
+	printk("Frontend: frame timed out, returning buffers.\n");
+
+	mutex_lock(&dev->node->job_lock);
+	sunxi_fe_reset(dev);
+	mutex_unlock(&dev->node->job_lock);
+
+	sunxi_fe_frame_done(&active, VB2_BUF_STATE_ERROR);
+	if (active.finish_job)
+		v4l2_m2m_job_finish(dev->node->m2m_dev,
+		    active.ctx->fh.m2m_ctx);
+
+	if (staged.ctx) {
+		sunxi_fe_frame_done(&staged, VB2_BUF_STATE_ERROR);
+		if (staged.finish_job)
+			v4l2_m2m_job_finish(dev->node->m2m_dev,
+			    staged.ctx->fh.m2m_ctx);
+	}
+
+	wake_up(&dev->node->frame_wq);
+
+	/* Carry on with the frames of a batch that were not staged yet. */
+	sunxi_fe_stage_next(dev->node);
+}
+
+/*
+ * sunxi_fe_irq() - reads and acks the interrupt status
+ *
+ * Only the write-back interrupt is enabled. The staged frame is started right
+ * away so the hardware does not idle while the irq thread returns the buffers
+ * of the finished frame and the m2m core schedules the next job.
+ */
+static irqreturn_t sunxi_fe_irq(int irq, void *priv)
+{
+	struct sunxi_fe_device *dev = priv;
+	unsigned int status, ctrl;
+	bool advance = false, latched = false;
+
+	if (regmap_read(dev->regs, DEFE_INT_STATUS_REG, &status))
+		return IRQ_NONE;
+
+	status &= DEFE_WB_INT_STATUS | DEFE_REG_LOAD_INT_STATUS;
+	if (!status)
+		return IRQ_NONE;
+
+	regmap_write(dev->regs, DEFE_INT_STATUS_REG, status);
+
+	spin_lock(&dev->irqlock);
+	/* Frames started through the misc device are not tracked. */
+	if ((status & DEFE_WB_INT_STATUS) && dev->active.ctx &&
+	    !dev->active.direct) {
+		advance = true;
+	} else if ((status & DEFE_REG_LOAD_INT_STATUS) && dev->staged.ctx &&
+	    dev->staged.direct) {
+		/*
+		 * A direct frame is latched at a frame start of the display.
+		 * The load may also be the one of the frame before it, in
+		 * which case its REG_RDY is still pending.
+		 */
+		latched = !regmap_read(dev->regs, DEFE_FRM_CTRL_REG, &ctrl) &&
+		    !(ctrl & DEFE_REG_RDY_MASK);
+		advance = latched;
+	}
+
+	if (!advance) {
+		spin_unlock(&dev->irqlock);
+		return IRQ_HANDLED;
+	}
+
+	dev->done = dev->active;
+	dev->active = dev->staged;
+	dev->staged.ctx = NULL;
+	/* A latched direct frame runs already. */
+	if (dev->active.ctx && !latched)
+		sunxi_fe_kick(dev);
+	spin_unlock(&dev->irqlock);
+
+	return IRQ_WAKE_THREAD;
+}
+
+static irqreturn_t sunxi_fe_irq_thread(int irq, void *priv)
+{
+	struct sunxi_fe_device *dev = priv;
+	struct sunxi_de_fe_ctx *finish_ctx = NULL;
+	struct sunxi_fe_frame done;
+	unsigned long flags;
+
+	spin_lock_irqsave(&dev->irqlock, flags);
+	done = dev->done;
+	dev->done.ctx = NULL;
+
+	/* The job of a promoted frame ends now that it is running. */
+	if (dev->active.ctx && dev->active.finish_job) {
+		dev->active.finish_job = false;
+		finish_ctx = dev->active.ctx;
+	}
+
+	if (sunxi_fe_frame_pending(dev))
+		mod_delayed_work(system_wq, &dev->watchdog_work,
+		    msecs_to_jiffies(SUNXI_FE_JOB_TIMEOUT_MS));
+	else
+		cancel_delayed_work(&dev->watchdog_work);
+	spin_unlock_irqrestore(&dev->irqlock, flags);
+
+	if (done.ctx)
+		sunxi_fe_frame_done(&done, VB2_BUF_STATE_DONE);
+
+	wake_up(&dev->node->frame_wq);
+
+	if (finish_ctx) {
+		v4l2_m2m_job_finish(dev->node->m2m_dev,
+		    finish_ctx->fh.m2m_ctx);
+
+		/* The next job stages on, but done may have ended a drain. */
+		mutex_lock(&dev->node->job_lock);
+		sunxi_fe_drain_node(dev->node);
+		mutex_unlock(&dev->node->job_lock);
+	} else {
+		sunxi_fe_stage_next(dev->node);
+	}
+
+	return IRQ_HANDLED;
+}
+
+/*
+ * sunxi_fe_fanout_sync() - gives a target the input of the source ctx
+ *
+ * The registers of the target are only rebuilt when the input or its own
+ * configuration changed. Called with job_lock held.
+ */
+static int sunxi_fe_fanout_sync(struct sunxi_de_fe_ctx *ctx,
+    struct sunxi_de_fe_ctx *target)
+{
+	struct sunxi_fe_config cfg;
+
+	cfg = target->cfg;
+	cfg.in_width = ctx->cfg.in_width;
+	cfg.in_height = ctx->cfg.in_height;
+	cfg.in_buffers = ctx->cfg.in_buffers;
+	cfg.field = ctx->cfg.field;
+	cfg.crop = ctx->cfg.crop;
+	cfg.input_fmt = ctx->cfg.input_fmt;
+
+	if (!target->fanout_dirty && !memcmp(&cfg, &target->cfg, sizeof(cfg)))
+		return target->geo.nr_planes ? 0 : -EINVAL;
+
+	target->cfg = cfg;
+	target->fanout_dirty = false;
+	if (sunxi_fe_build_regs(&target->cfg, &target->geo, target->regs,
+	    ARRAY_SIZE(target->regs))) {
+		target->geo.nr_planes = 0;
+		return -EINVAL;
+	}
+
+	return 0;
+}
+
+/*
+ * sunxi_fe_fanout_take() - picks the targets of the next field of ctx
+ *
+ * Targets without a free capture buffer skip the field. Called with job_lock
+ * held.
+ */
+static void sunxi_fe_fanout_take(struct sunxi_fe_node *node,
+    struct sunxi_de_fe_ctx *ctx)
+{
+	struct sunxi_de_fe_ctx *target;
+
+	ctx->nr_fanout = 0;
+	if (!ctx->fanout_group)
+		return;
+
+	list_for_each_entry(target, &node->fanout_list, fanout_entry) {
+		if (ctx->nr_fanout == SUNXI_FE_MAX_FANOUT)
+			break;
+
+		if (target == ctx || target->direct ||
+		    target->fanout_group != ctx->fanout_group ||
+		    !sunxi_fe_fanout_target(target) ||
+		    !vb2_is_streaming(v4l2_m2m_get_dst_vq(
+		    target->fh.m2m_ctx)) ||
+		    !v4l2_m2m_num_dst_bufs_ready(target->fh.m2m_ctx) ||
+		    sunxi_fe_fanout_sync(ctx, target))
+			continue;
+
+		ctx->fanout[ctx->nr_fanout++] = target;
+	}
+}
+
+/*
+ * sunxi_fe_fanout_remove() - drops target from the fields being fanned out
+ *
+ * Called with job_lock held when target stops streaming.
+ */
+static void sunxi_fe_fanout_remove(struct sunxi_fe_node *node,
+    struct sunxi_de_fe_ctx *target)
+{
+	struct sunxi_de_fe_ctx *ctx;
+	unsigned int i;
+
+	list_for_each_entry(ctx, &node->fanout_list, fanout_entry)
+		for (i = 0; i < ctx->nr_fanout; i++)
+			if (ctx->fanout[i] == target)
+				ctx->fanout[i] = NULL;
+}
+
+/*
+ * sunxi_fe_pass_ctx() - returns the context whose output is staged next
+ *
+ * That is the next fan-out target of ctx, or ctx itself once all targets
+ * have had the current field. Called with job_lock held.
+ */
+static struct sunxi_de_fe_ctx *sunxi_fe_pass_ctx(struct sunxi_de_fe_ctx *ctx)
+{
+
+	for (; ctx->target < ctx->nr_fanout; ctx->target++) {
+		if (ctx->fanout[ctx->target])
+			return ctx->fanout[ctx->target];
+
+		/* The target stopped, possibly halfway its stripes. */
+		ctx->stripe = 0;
+	}
+
+	return ctx;
+}
+
+/*
+ * sunxi_fe_next_pass() - moves ctx on to the next stripe, target or field
+ *
+ * pass_ctx is the context whose output was staged. Called with job_lock
+ * held.
+ */
+static void sunxi_fe_next_pass(struct sunxi_de_fe_ctx *ctx,
+    struct sunxi_de_fe_ctx *pass_ctx)
+{
+
+	if (++ctx->stripe < pass_ctx->geo.nr_stripes)
+		return;
+
+	ctx->stripe = 0;
+	if (pass_ctx != ctx) {
+		ctx->target++;
+		return;
+	}
+
+	ctx->target = 0;
+	ctx->nr_fanout = 0;
+	if (ctx->geo.field != FE_GEO_FIELD_NONE)
+		ctx->field = !ctx->field;
+}
+
+/*
+ * sunxi_fe_core_holds() - whether a frame slot of dev holds buffers of ctx
+ */
+static bool sunxi_fe_core_holds(struct sunxi_fe_device *dev,
+    struct sunxi_de_fe_ctx *ctx)
+{
+	unsigned long flags;
+	bool holds;
+
+	spin_lock_irqsave(&dev->irqlock, flags);
+	holds = sunxi_fe_frame_uses(&dev->active, ctx) ||
+	    sunxi_fe_frame_uses(&dev->staged, ctx) ||
+	    sunxi_fe_frame_uses(&dev->done, ctx);
+	spin_unlock_irqrestore(&dev->irqlock, flags);
+
+	return holds;
+}
+
+/*
+ * sunxi_fe_pick_core() - selects the front-end for the next frame of ctx
+ *
+ * pass_ctx is the context the frame is written for. Frames stay on the
+ * front-end that still holds frames of either context, so that they complete
+ * in order. Otherwise an idle front-end is preferred over one that can only
+ * take a staged frame. Direct frames are shown by the back-end of the first
+ * front-end. Returns NULL if the frame has to wait for a front-end that is
+ * leaving the node. Called with job_lock held.
+ */
+static struct sunxi_fe_device *sunxi_fe_pick_core(struct sunxi_fe_node *node,
+    struct sunxi_de_fe_ctx *ctx, struct sunxi_de_fe_ctx *pass_ctx)
+{
+	struct sunxi_fe_device *dev, *spare = NULL;
+	unsigned long flags;
+	unsigned int i;
+	bool idle, stageable;
+
+	if (pass_ctx->direct || node->nr_cores == 1) {
+		dev = node->cores[0];
+		return dev->detaching ? NULL : dev;
+	}
+
+	for (i = 0; i < node->nr_cores; i++) {
+		dev = node->cores[i];
+		if (sunxi_fe_core_holds(dev, ctx) ||
+		    sunxi_fe_core_holds(dev, pass_ctx))
+			return dev->detaching ? NULL : dev;
+	}
+
+	for (i = 0; i < node->nr_cores; i++) {
+		dev = node->cores[i];
+		if (dev->detaching)
+			continue;
+
+		spin_lock_irqsave(&dev->irqlock, flags);
+		idle = !dev->active.ctx;
+		stageable = !dev->staged.ctx && !dev->active.direct;
+		spin_unlock_irqrestore(&dev->irqlock, flags);
+
+		if (idle)
+			return dev;
+		if (stageable && !spare)
+			spare = dev;
+	}
+
+	if (spare)
+		return spare;
+
+	return ctx->dev->detaching ? NULL : ctx->dev;
+}
+
+/*
+ * sunxi_fe_ctx_take_pending() - switches ctx to its pending conversion
+ *
+ * Called with job_lock held before the first stripe of a frame is staged.
+ */
+static void sunxi_fe_ctx_take_pending(struct sunxi_de_fe_ctx *ctx)
+{
+
+	ctx->cfg = ctx->pending_cfg;
+	ctx->geo = ctx->pending_geo;
+	memcpy(ctx->regs, ctx->pending_regs, sizeof(ctx->regs));
+	ctx->pending = false;
+}
+
+/*
+ * sunxi_fe_stage_next() - hands the next frames of the running job to the hw
+ *
+ * A job processes batch_size frames of its context. Frames are staged as long
+ * as the staged slot of their front-end is free; the irq thread calls this
+ * again once a staged frame has been started. The job finishes when its last
+ * frame is started, so the next job can already run on another front-end.
+ */
+static void sunxi_fe_stage_next(struct sunxi_fe_node *node)
+{
+	struct sunxi_de_fe_ctx *ctx, *pass_ctx, *finish_ctx = NULL;
+	struct sunxi_fe_device *dev;
+	struct sunxi_fe_frame frame;
+	unsigned long flags;
+	bool started, full;
+
+	mutex_lock(&node->job_lock);
+	while (node->job_ctx) {
+		ctx = node->job_ctx;
+
+		/*
+		 * Each field of the source is scaled for the fan-out targets
+		 * first, while its input setup is loaded, and for the context
+		 * itself last, which finishes the job. A conversion set
+		 * meanwhile takes over before that.
+		 */
+		if (!ctx->target && !ctx->stripe) {
+			if (ctx->pending)
+				sunxi_fe_ctx_take_pending(ctx);
+			sunxi_fe_fanout_take(node, ctx);
+		}
+		pass_ctx = sunxi_fe_pass_ctx(ctx);
+		dev = sunxi_fe_pick_core(node, ctx, pass_ctx);
+		if (!dev)
+			break;
+
+		/*
+		 * While a direct frame is shown the front-end feeds the
+		 * display, so only another direct frame can take over.
+		 */
+		spin_lock_irqsave(&dev->irqlock, flags);
+		full = dev->staged.ctx != NULL || (dev->active.ctx &&
+		    dev->active.direct && !pass_ctx->direct);
+		spin_unlock_irqrestore(&dev->irqlock, flags);
+		if (full)
+			break;
+
+		/*
+		 * Other scaler filters can only be loaded once the running
+		 * frame is done; the irq thread calls us again then. A direct
+		 * frame is only done when the next one replaces it, so that
+		 * one loads its filters while the shown frame still reads
+		 * them: the rest of that frame on screen is scaled with the
+		 * new filters. This is accepted, it is a single frame at a
+		 * change of the scaling ratio.
+		 */
+		if (sunxi_fe_coef_changed(dev, &pass_ctx->regs[0])) {
+			spin_lock_irqsave(&dev->irqlock, flags);
+			full = dev->active.ctx && !dev->active.direct;
+			spin_unlock_irqrestore(&dev->irqlock, flags);
+			if (full)
+				break;
+
+			if (sunxi_fe_load_coefs(dev, &pass_ctx->regs[0]))
+				printk("Frontend: could not load scaler "
+				    "filters.\n");
+		}
+
+		/*
+		 * The stripes of a frame are staged one after another. The
+		 * buffers stay queued until the last stripe, the source until
+		 * the last target has had its bottom field.
+		 */
+		frame.ctx = pass_ctx;
+		frame.src_ctx = ctx;
+		frame.field = ctx->field;
+		frame.stripe = ctx->stripe;
+		frame.keep_dst = ctx->stripe + 1 < pass_ctx->geo.nr_stripes;
+		frame.keep_src = pass_ctx != ctx || frame.keep_dst ||
+		    (ctx->geo.field != FE_GEO_FIELD_NONE && !ctx->field);
+		if (frame.keep_src)
+			frame.src = v4l2_m2m_next_src_buf(ctx->fh.m2m_ctx);
+		else
+			frame.src = v4l2_m2m_src_buf_remove(ctx->fh.m2m_ctx);
+		if (frame.keep_dst)
+			frame.dst = v4l2_m2m_next_dst_buf(
+			    pass_ctx->fh.m2m_ctx);
+		else
+			frame.dst = v4l2_m2m_dst_buf_remove(
+			    pass_ctx->fh.m2m_ctx);
+		frame.finish_job = pass_ctx == ctx && !frame.keep_dst &&
+		    --node->job_left == 0;
+		frame.direct = pass_ctx->direct;
+		if (frame.src && frame.dst) {
+			sunxi_fe_next_pass(ctx, pass_ctx);
+			ctx->dev = dev;
+			pass_ctx->dev = dev;
+		}
+
+		if (!frame.src || !frame.dst) {
+			if (frame.src && !frame.keep_src)
+				sunxi_fe_buf_done(frame.src,
+				    VB2_BUF_STATE_ERROR);
+			if (frame.dst && !frame.keep_dst)
+				sunxi_fe_buf_done(frame.dst,
+				    VB2_BUF_STATE_ERROR);
+			frame.finish_job = true;
+		} else if (sunxi_fe_stage_frame(dev, &frame)) {
+			sunxi_fe_frame_done(&frame, VB2_BUF_STATE_ERROR);
+		} else {
+			spin_lock_irqsave(&dev->irqlock, flags);
+			started = !dev->active.ctx;
+			if (started) {
+				dev->active = frame;
+				dev->active.finish_job = false;
+				sunxi_fe_kick(dev);
+			} else {
+				dev->staged = frame;
+			}
+			if (sunxi_fe_frame_pending(dev))
+				mod_delayed_work(system_wq,
+				    &dev->watchdog_work, msecs_to_jiffies(
+				    SUNXI_FE_JOB_TIMEOUT_MS));
+			spin_unlock_irqrestore(&dev->irqlock, flags);
+
+			/* A staged frame finishes its job when started. */
+			if (!started && frame.finish_job) {
+				node->job_ctx = NULL;
+				break;
+			}
+		}
+
+		if (frame.finish_job) {
+			node->job_ctx = NULL;
+			finish_ctx = ctx;
+		}
+	}
+	sunxi_fe_drain_node(node);
+	mutex_unlock(&node->job_lock);
+
+	if (finish_ctx)
+		v4l2_m2m_job_finish(node->m2m_dev, finish_ctx->fh.m2m_ctx);
+}
+
+/*
+ * sunxi_fe_queued_frames() - frames ctx can process with its queued buffers
+ *
+ * Each source buffer of an interlaced stream gives two frames, the top field
+ * of the first one may already be done.
+ */
+static unsigned int sunxi_fe_queued_frames(struct sunxi_de_fe_ctx *ctx)
+{
+	unsigned int nr_src, nr_dst;
+
+	nr_src = v4l2_m2m_num_src_bufs_ready(ctx->fh.m2m_ctx);
+	if (ctx->geo.field != FE_GEO_FIELD_NONE && nr_src)
+		nr_src = nr_src * FE_GEO_NR_FIELDS - ctx->field;
+	nr_dst = v4l2_m2m_num_dst_bufs_ready(ctx->fh.m2m_ctx);
+
+	return min(nr_src, nr_dst);
+}
+
+/*
+ * device_run() - prepares and starts processing
+ *
+ * The buffers are taken off the m2m queues and the registers are written to
+ * the shadow registers. When the hardware is idle the frame is started and,
+ * if it was the last frame of the batch, the job finishes immediately, so
+ * that the next job can be staged while this frame is processed. Otherwise
+ * the frame waits in the staged slot and is started from the irq of the
+ * running frame.
+ */
+static void device_run(void *priv)
+{
+	struct sunxi_de_fe_ctx *ctx;
+	struct sunxi_fe_node *node;
+
+	ctx = priv;
+	node = ctx->node;
+	PRINT_DE_FE("de_fe %s();\n", __FUNCTION__);
+
+	mutex_lock(&node->job_lock);
+	node->job_ctx = ctx;
+	node->job_left = ctx->batch_size;
+	if (READ_ONCE(ctx->flush)) {
+		WRITE_ONCE(ctx->flush, false);
+		node->job_left = clamp(sunxi_fe_queued_frames(ctx), 1U,
+		    ctx->batch_size);
+	}
+	mutex_unlock(&node->job_lock);
+
+	sunxi_fe_stage_next(node);
+}
+
+/*
+ * job_ready() - a job processes a whole batch, so wait until it is queued
+ *
+ * A flushed context runs whatever it has queued instead.
+ */
+static int job_ready(void *priv)
+{
+	struct sunxi_de_fe_ctx *ctx = priv;
+	unsigned int nr_frames;
+
+	nr_frames = READ_ONCE(ctx->flush) ? 1 : ctx->batch_size;
+	if (sunxi_fe_queued_frames(ctx) < nr_frames)
+		return 0;
+
+	return 1;
+}
+
+/*
+ * sunxi_fe_flush_work() - runs the short batch left once the queues are idle
+ */
+static void sunxi_fe_flush_work(struct work_struct *work)
+{
+	struct sunxi_de_fe_ctx *ctx;
+
+	ctx = container_of(to_delayed_work(work), struct sunxi_de_fe_ctx,
+	    flush_work);
+	WRITE_ONCE(ctx->flush, true);
+	v4l2_m2m_try_schedule(ctx->fh.m2m_ctx);
+}
+
+static void job_abort(void *priv)
+{
+	struct sunxi_de_fe_ctx *ctx = priv;
+	struct sunxi_fe_node *node = ctx->node;
+	struct sunxi_fe_device *dev;
+	unsigned long flags;
+	bool finish = false;
+
+	PRINT_DE_FE("de_fe %s();\n", __FUNCTION__);
+
+	/*
+	 * Drop the frames of the batch that were not staged yet. A staged
+	 * frame still finishes the job when it is started, else the job ends
+	 * here. It was staged last, so it is on the front-end of ctx.
+	 */
+	mutex_lock(&node->job_lock);
+	if (node->job_ctx == ctx) {
+		node->job_ctx = NULL;
+		dev = ctx->dev;
+		spin_lock_irqsave(&dev->irqlock, flags);
+		if (dev->staged.ctx == ctx)
+			dev->staged.finish_job = true;
+		else
+			finish = true;
+		spin_unlock_irqrestore(&dev->irqlock, flags);
+	}
+	mutex_unlock(&node->job_lock);
+
+	if (finish)
+		v4l2_m2m_job_finish(node->m2m_dev, ctx->fh.m2m_ctx);
+}
+
+/*
+ * The noop_llseek() is an llseek() operation that filesystems can use that
+ * don't want to support seeking (leave the file->f_pos untouched) but still
+ * want to let the syscall itself to succeed.
+ *
+ * [PATCH 01/15] Introduce noop_llseek()
+ * http://www.spinics.net/lists/linux-fsdevel/msg28104.html
+ */
+static const struct file_operations sunxi_fe_fops = {
+	.owner		= THIS_MODULE,
+	.open		= sunxi_fe_misc_open,
+	.release	= sunxi_fe_misc_release,
+	.unlocked_ioctl	= &sunxi_fe_ioctl,
+	.write		= proc_sunxi_de_fe_write,
+	.llseek		= noop_llseek,
+};
+
+static const struct v4l2_file_operations sunxi_fe_v4l2_fops = {
+	.owner		= THIS_MODULE,
+	.open		= sunxi_fe_open,
+	.release	= sunxi_fe_release,
+	.poll		= v4l2_m2m_fop_poll,
+	.unlocked_ioctl	= video_ioctl2,
+	.mmap		= v4l2_m2m_fop_mmap,
+};
+
+/*
+ * Disabled some ioc as this driver will handle preallocated buffers by the
+ * cedrus driver.
+ */
+static const struct v4l2_ioctl_ops sunxi_fe_v4l2_ioctl_ops = {
+	.vidioc_querycap			= vidioc_querycap,
+
+	.vidioc_enum_fmt_vid_cap	= vidioc_enum_fmt_vid_cap,
+	.vidioc_g_fmt_vid_cap_mplane	= vidioc_g_fmt_vid_cap,
+	.vidioc_try_fmt_vid_cap_mplane	= vidioc_try_fmt_vid_cap,
+	.vidioc_s_fmt_vid_cap_mplane	= vidioc_s_fmt_vid_cap,
+
+	.vidioc_enum_fmt_vid_out_mplane = vidioc_enum_fmt_vid_out,
+	.vidioc_g_fmt_vid_out_mplane	= vidioc_g_fmt_vid_out,
+	.vidioc_try_fmt_vid_out_mplane	= vidioc_try_fmt_vid_out,
+	.vidioc_s_fmt_vid_out_mplane	= vidioc_s_fmt_vid_out,
+
+	.vidioc_g_selection	= vidioc_g_selection,
+	.vidioc_s_selection	= vidioc_s_selection,
+
+	.vidioc_g_parm		= vidioc_g_parm,
+	.vidioc_s_parm		= vidioc_s_parm,
+
+	.vidioc_try_decoder_cmd	= vidioc_try_decoder_cmd,
+	.vidioc_decoder_cmd	= vidioc_decoder_cmd,
+
+	.vidioc_subscribe_event	= vidioc_subscribe_event,
+	.vidioc_unsubscribe_event = v4l2_event_unsubscribe,
+
+	.vidioc_reqbufs		= v4l2_m2m_ioctl_reqbufs,
+	.vidioc_querybuf	= v4l2_m2m_ioctl_querybuf,
+	.vidioc_prepare_buf	= v4l2_m2m_ioctl_prepare_buf,
+	.vidioc_create_bufs	= v4l2_m2m_ioctl_create_bufs,
+	.vidioc_expbuf		= v4l2_m2m_ioctl_expbuf,
+
+	.vidioc_qbuf		= v4l2_m2m_ioctl_qbuf,
+	.vidioc_dqbuf		= v4l2_m2m_ioctl_dqbuf,
+
+	.vidioc_streamon	= v4l2_m2m_ioctl_streamon,
+	.vidioc_streamoff	= v4l2_m2m_ioctl_streamoff,
+};
+
+static struct v4l2_m2m_ops m2m_ops = {
+	.device_run	= device_run,
+	.job_ready	= job_ready,
+	.job_abort	= job_abort,
+};
+
+/* This replaces the platform device. */
+static struct video_device sunxi_de_fe_viddev = {
 	.name		= DRV_NAME,
 	.vfl_dir	= VFL_DIR_M2M,
 	.fops		= &sunxi_fe_v4l2_fops,
@@ -577,74 +2350,345 @@ static struct video_device sunxi_de_fe_viddev = {
 	.release	= video_device_release_empty,
 };
 
-static int sfe_ioctl_set_input(unsigned long arg)
+static int sfe_ioctl_set_input(struct sunxi_fe_device *dev,
+    unsigned long arg)
+{
+	struct sfe_input_buffers input_buffers;
+	uint32_t i;
+
+	printk("SFE_IOCTL_SET_INPUT\n");
+	if ((void __user *)arg == NULL) {
+		printk("Error: input_buffers == NULL\n");
+		return -EINVAL;
+	}
+
+	if (copy_from_user(&input_buffers, (void __user *)arg,
+	    sizeof(input_buffers))) {
+		printk("Error getting input buffers from user\n");
+		return -EFAULT;
+	}
+
+	switch (dev->cfg.input_fmt) {
+	case FE_FORMAT_MB32_NV12:
+		printk("configured input format is DRM_FORMAT_YUV420\n");
+		/*
+		 * The 1st buffer contains Y buffer data.
+		 * The 2nd buffer contains UV buffer data.
+		 */
+		for (i = 0; i < 2; i++) {
+			if (input_buffers.buf[i].base == NULL) {
+				printk("Input format is set to YUV420. "
+				    "Therefore the first 2 buffers in "
+				    "input_buffers cannot be NULL\n");
+				return -EINVAL;
+			}
+
+			if (input_buffers.buf[i].size_in_bytes < 1) {
+				printk("Buffer size cannot be less than 1\n");
+				return -EINVAL;
+			}
+
+			PRINT_DE_FE("Before copy_from_user usr_ptr = %p\n",
+			    input_buffers.buf[i].base);
+
+			//TODO: Buffers are already alloced in open call and
+			// freed in release. Make it so that the copy is not
+			// needed anymore.
+			if (copy_from_user(dev->in_bufs.buf[i].base,
+			    input_buffers.buf[i].base,
+			    input_buffers.buf[i].size_in_bytes)) {
+				printk("Failed copying buffer from userland\n");
+				return -EFAULT;
+			}
+			PRINT_DE_FE("After copy_from_user\n");
+			dev->in_bufs.buf[i].size_in_bytes =
+			    input_buffers.buf[i].size_in_bytes;
+		}
+		break;
+	default:
+		printk("Error: Front end configuration is not set or "
+		    "unsupported\n");
+		return -EINVAL;
+	}
+	PRINT_DE_FE("Succesfully parsed %d input buffers from userland\n", i);
+	return 0;
+}
+
+static void sunxi_fe_dmabuf_put(struct sunxi_fe_dmabuf *dmabuf)
+{
+
+	if (!dmabuf->buf)
+		return;
+
+	dma_buf_unmap_attachment(dmabuf->attach, dmabuf->sgt, DMA_TO_DEVICE);
+	dma_buf_detach(dmabuf->buf, dmabuf->attach);
+	dma_buf_put(dmabuf->buf);
+	memset(dmabuf, 0, sizeof(*dmabuf));
+}
+
+/*
+ * sunxi_fe_dmabuf_get() - imports a dma-buf for reading by the front-end
+ *
+ * The front-end has no iommu, so the buffer must be physically contiguous,
+ * and it reads extent bytes from offset on, which must lie inside it.
+ */
+static int sunxi_fe_dmabuf_get(struct sunxi_fe_device *dev, int fd,
+    uint32_t offset, uint32_t extent, struct sunxi_fe_dmabuf *dmabuf,
+    dma_addr_t *addr)
+{
+	int ret;
+
+	dmabuf->buf = dma_buf_get(fd);
+	if (IS_ERR(dmabuf->buf)) {
+		ret = PTR_ERR(dmabuf->buf);
+		dmabuf->buf = NULL;
+		return ret;
+	}
+
+	if (!extent || offset >= dmabuf->buf->size ||
+	    extent > dmabuf->buf->size - offset) {
+		printk("Frontend: plane of %u bytes at %u does not fit in "
+		    "dma-buf %d of %zu bytes\n", extent, offset, fd,
+		    dmabuf->buf->size);
+		ret = -EINVAL;
+		goto err_put;
+	}
+
+	dmabuf->attach = dma_buf_attach(dmabuf->buf, dev->dev);
+	if (IS_ERR(dmabuf->attach)) {
+		ret = PTR_ERR(dmabuf->attach);
+		goto err_put;
+	}
+
+	dmabuf->sgt = dma_buf_map_attachment(dmabuf->attach, DMA_TO_DEVICE);
+	if (IS_ERR(dmabuf->sgt)) {
+		ret = PTR_ERR(dmabuf->sgt);
+		goto err_detach;
+	}
+
+	if (dmabuf->sgt->nents != 1) {
+		printk("Frontend: dma-buf %d is not contiguous\n", fd);
+		ret = -EINVAL;
+		goto err_unmap;
+	}
+
+	*addr = sg_dma_address(dmabuf->sgt->sgl) + offset;
+	return 0;
+
+err_unmap:
+	dma_buf_unmap_attachment(dmabuf->attach, dmabuf->sgt, DMA_TO_DEVICE);
+err_detach:
+	dma_buf_detach(dmabuf->buf, dmabuf->attach);
+err_put:
+	dma_buf_put(dmabuf->buf);
+	memset(dmabuf, 0, sizeof(*dmabuf));
+	return ret;
+}
+
+/*
+ * sfe_ioctl_set_input_dmabuf() - points the input dma at imported dma-bufs
+ *
+ * Replaces the copy of SFE_IOCTL_SET_INPUT: the planes are read by the
+ * front-end straight from the buffers of the producer, e.g. cedrus. The
+ * buffers stay mapped until the next call, so a frame started with
+ * SFE_IOCTL_UPDATE_BUFFER must have finished before they are replaced.
+ */
+static int sfe_ioctl_set_input_dmabuf(struct sunxi_fe_device *dev,
+    unsigned long arg)
+{
+	struct sunxi_fe_dmabuf dmabuf[MAX_INPUT_BUFFERS] = {};
+	dma_addr_t addr[MAX_INPUT_BUFFERS];
+	struct sfe_input_dmabuf input;
+	struct fe_geometry *geo;
+	unsigned int i;
+	int ret;
+
+	PRINT_DE_FE("SFE_IOCTL_SET_INPUT_DMABUF\n");
+	if (copy_from_user(&input, (void __user *)arg, sizeof(input))) {
+		printk("Error getting input dma-bufs from user\n");
+		return -EFAULT;
+	}
+
+	mutex_lock(&dev->node->job_lock);
+	if (sunxi_fe_misc_busy(dev)) {
+		printk("Error: Front end is busy streaming\n");
+		ret = -EBUSY;
+		goto out_unlock;
+	}
+
+	geo = &dev->misc_geo;
+	if (!geo->nr_planes) {
+		printk("Error: Front end configuration is not set\n");
+		ret = -EINVAL;
+		goto out_unlock;
+	}
+
+	for (i = 0; i < geo->nr_planes; i++) {
+		ret = sunxi_fe_dmabuf_get(dev, input.fd[i],
+		    input.offset[i], fe_geometry_in_extent(&dev->cfg, i),
+		    &dmabuf[i], &addr[i]);
+		if (ret) {
+			printk("Error: Could not import dma-buf of plane %u\n",
+			    i);
+			goto err_put;
+		}
+	}
+
+	for (i = 0; i < geo->nr_planes; i++) {
+		addr[i] += geo->stripe[0].in_offset[i];
+		ret = regmap_write(dev->regs, DEFE_BUF_ADDR0_REG +
+		    geo->plane[i].idma * IN_CHAN_ADDR_OFFSET,
+		    addr[i] - PHYS_OFFSET);
+		if (ret) {
+			printk("Could not set input addr of plane %u.\n", i);
+			goto err_put;
+		}
+	}
+
+	for (i = 0; i < MAX_INPUT_BUFFERS; i++) {
+		sunxi_fe_dmabuf_put(&dev->in_dmabuf[i]);
+		dev->in_dmabuf[i] = dmabuf[i];
+		dev->dma_in_addr[i] = dmabuf[i].buf ? addr[i] : 0;
+	}
+	mutex_unlock(&dev->node->job_lock);
+
+	return 0;
+
+err_put:
+	for (i = 0; i < geo->nr_planes; i++)
+		sunxi_fe_dmabuf_put(&dmabuf[i]);
+out_unlock:
+	mutex_unlock(&dev->node->job_lock);
+	return ret;
+}
+
+/*
+ * sunxi_fe_build_regs() - fills a register image for each stripe of a
+ * conversion
+ *
+ * Fails if the conversion needs more than nr_imgs stripes. The output of
+ * the misc device and direct output can not be split into stripes.
+ */
+static int sunxi_fe_build_regs(struct sunxi_fe_config *cfg,
+    struct fe_geometry *geo, struct fe_reg_image *img, unsigned int nr_imgs)
 {
-	struct sfe_input_buffers input_buffers;
-	uint32_t i;
+	unsigned int i;
+	int ret;
 
-	printk("SFE_IOCTL_SET_INPUT\n");
-	if ((void __user *)arg == NULL) {
-		printk("Error: input_buffers == NULL\n");
-		return -EINVAL;
-	}
+	fe_reg_image_init(img);
 
-	if (copy_from_user(&input_buffers, (void __user *)arg,
-	    sizeof(input_buffers))) {
-		printk("Error getting input buffers from user\n");
-		return -EFAULT;
+	ret = fe_geometry_plan(cfg, geo);
+	if (ret) {
+		printk("Error: Conversion from %ux%u to %ux%u is not supported "
+		    "(%d).\n", cfg->in_width, cfg->in_height, cfg->out_width,
+		    cfg->out_height, ret);
+		return -1;
 	}
 
-	switch (sunxi_fe_dev->input_fmt) {
-	case DRM_FORMAT_YUV420:
-		//TODO: Check for a YUV420 TILED define.
-		printk("configured input format is DRM_FORMAT_YUV420\n");
-		/*
-		 * The 1st buffer contains Y buffer data.
-		 * The 2nd buffer contains UV buffer data.
-		 */
-		for (i = 0; i < 2; i++) {
-			if (input_buffers.buf[i].base == NULL) {
-				printk("Input format is set to YUV420. "
-				    "Therefore the first 2 buffers in "
-				    "input_buffers cannot be NULL\n");
-				return -EINVAL;
-			}
+	if (setup_csc(cfg, geo, img) < 0) {
+		printk("Error: Could not configure color space converter with "
+		    "current settings.\n");
+		return -1;
+	}
 
-			if (input_buffers.buf[i].size_in_bytes < 1) {
-				printk("Buffer size cannot be less than 1\n");
-				return -EINVAL;
-			}
+	if (setup_fe_dma_channels(geo, img)) {
+		printk("Error: Could not configure dma channels "
+		    "with current settings.\n");
+		return -1;
+	}
 
-			PRINT_DE_FE("Before copy_from_user usr_ptr = %p\n",
-			    input_buffers.buf[i].base);
+	if (geo->nr_stripes > nr_imgs) {
+		printk("Error: Output width %u needs %u stripes.\n",
+		    cfg->out_width, geo->nr_stripes);
+		return -1;
+	}
 
-			//TODO: Buffers are already alloced in open call and
-			// freed in release. Make it so that the copy is not
-			// needed anymore.
-			if (copy_from_user(sunxi_fe_dev->in_bufs.buf[i].base,
-			    input_buffers.buf[i].base,
-			    input_buffers.buf[i].size_in_bytes)) {
-				printk("Failed copying buffer from userland\n");
-				return -EFAULT;
-			}
-			PRINT_DE_FE("After copy_from_user\n");
-			sunxi_fe_dev->in_bufs.buf[i].size_in_bytes =
-			    input_buffers.buf[i].size_in_bytes;
+	for (i = 1; i < geo->nr_stripes; i++) {
+		img[i] = img[0];
+		if (setup_fe_stripe(geo, i, &img[i])) {
+			printk("Error: Could not configure stripe %u.\n", i);
+			return -1;
 		}
-		break;
-	default:
-		printk("Error: Front end configuration is not set or "
-		    "unsupported\n");
-		return -EINVAL;
 	}
-	PRINT_DE_FE("Succesfully parsed %d input buffers from userland\n", i);
+
+	return 0;
+}
+
+/*
+ * sunxi_fe_misc_busy() - whether the video device is using the front-end
+ *
+ * The misc device programs the registers directly, which would tear the
+ * frames of streaming contexts. Called with job_lock held.
+ */
+static bool sunxi_fe_misc_busy(struct sunxi_fe_device *dev)
+{
+	unsigned long flags;
+	bool busy;
+
+	spin_lock_irqsave(&dev->irqlock, flags);
+	busy = dev->active.ctx || dev->staged.ctx;
+	spin_unlock_irqrestore(&dev->irqlock, flags);
+
+	return busy || !list_empty(&dev->node->stream_list);
+}
+
+/*
+ * sunxi_fe_apply_config() - applies the staged configuration
+ *
+ * The configuration has been written to the shadow registers. REG_RDY makes
+ * the hardware latch them at the next frame start and is cleared once that
+ * has happened, so instead of sleeping we poll for that for at most a frame.
+ * If the front-end was idle and missed the start, it is kicked once more.
+ * Called with job_lock held.
+ */
+static int sunxi_fe_apply_config(struct sunxi_fe_device *dev)
+{
+	unsigned int val;
+	int i, ret;
+
+	for (i = 0; i < 2; i++) {
+		ret = regmap_write_bits(dev->regs, DEFE_FRM_CTRL_REG,
+		    DEFE_REG_RDY_MASK | DEFE_COEF_RDY_MASK |
+		    DEFE_FRM_START_START_MASK,
+		    DEFE_REG_RDY_EN(ENABLE) | DEFE_COEF_RDY_EN(ENABLE) |
+		    DEFE_FRM_START_BIT(ENABLE));
+		if (ret)
+			return ret;
+
+		ret = regmap_read_poll_timeout(dev->regs, DEFE_FRM_CTRL_REG,
+		    val, !(val & DEFE_REG_RDY_MASK), SUNXI_FE_CONFIG_POLL_US,
+		    SUNXI_FE_CONFIG_TIMEOUT_US);
+		if (!ret)
+			return 0;
+	}
+
+	printk("Frontend: configuration was not latched.\n");
+	return ret;
+}
+
+/*
+ * sunxi_fe_file_dev() - returns the front-end of a misc device or proc file
+ *
+ * misc_open() points the private data at the misc device, proc files leave
+ * it NULL.
+ */
+static struct sunxi_fe_device *sunxi_fe_file_dev(struct file *filp)
+{
+
+	if (filp->private_data)
+		return container_of(filp->private_data,
+		    struct sunxi_fe_device, misc);
+
+	return PDE_DATA(file_inode(filp));
 }
 
 static long sunxi_fe_ioctl(struct file *filp, unsigned int cmd,
     unsigned long arg)
 {
+	struct sunxi_fe_device *dev = sunxi_fe_file_dev(filp);
 	struct sfe_config user_config;
 	struct v4l2_buffer buf;
+	int ret;
 
 	/*
 	 * The ioctl()s defined here are for testing purposes only and have
@@ -672,10 +2716,19 @@ static long sunxi_fe_ioctl(struct file *filp, unsigned int cmd,
 		PRINT_DE_FE("Got a buffer from userland.\n");
 		PRINT_DE_FE("buf fd = 0x%x\n", buf.m.fd);
 
-		if (regmap_write(sunxi_fe_dev->regs, DEFE_FRM_CTRL_REG,
-		    DEFE_REG_RDY_EN(ENABLE) | DEFE_FRM_START_BIT(ENABLE))) {
+		mutex_lock(&dev->node->job_lock);
+		if (sunxi_fe_misc_busy(dev)) {
+			ret = -EBUSY;
+		} else {
+			ret = regmap_write_bits(dev->regs, DEFE_FRM_CTRL_REG,
+			    DEFE_REG_RDY_MASK | DEFE_FRM_START_START_MASK,
+			    DEFE_REG_RDY_EN(ENABLE) |
+			    DEFE_FRM_START_BIT(ENABLE)) ? -1 : 0;
+		}
+		mutex_unlock(&dev->node->job_lock);
+		if (ret) {
 			printk("Could not start frontend.\n");
-			return -1;
+			return ret;
 		}
 		break;
 	case SFE_IOCTL_SET_CONFIG:
@@ -713,40 +2766,46 @@ static long sunxi_fe_ioctl(struct file *filp, unsigned int cmd,
 			return -EINVAL;
 		}
 
-		// Store the sane values.
-		sunxi_fe_dev->input_fmt = user_config.input_fmt;
-		sunxi_fe_dev->output_fmt = user_config.output_fmt;
-		sunxi_fe_dev->in_width = user_config.in_width;
-		sunxi_fe_dev->in_height = user_config.in_height;
-		sunxi_fe_dev->out_width = user_config.out_width;
-		sunxi_fe_dev->out_height = user_config.out_height;
-
-		if (setup_fe_idma_channels(sunxi_fe_dev)) {
-			printk("Error: Could not configure input channels "
-			    "with current settings.\n");
-			return -1;
+		mutex_lock(&dev->node->job_lock);
+		if (sunxi_fe_misc_busy(dev)) {
+			mutex_unlock(&dev->node->job_lock);
+			printk("Error: Front end is busy streaming\n");
+			return -EBUSY;
 		}
 
-		if (setup_fe_odma_channels(sunxi_fe_dev)) {
-			printk("Error: Could not configure output channels "
-			    "with current settings.\n");
-			return -1;
-		}
-		
 		/*
-		 * When the front-end has been configured correctly, we don't
-		 * need two write here for the new image to appear.
+		 * Store the sane values. The misc device has always called
+		 * the tiled output of the VPU DRM_FORMAT_YUV420.
 		 */
-		if (regmap_write(sunxi_fe_dev->regs, DEFE_FRM_CTRL_REG,
-		    DEFE_REG_RDY_EN(ENABLE) | DEFE_COEF_RDY_EN(ENABLE) |
-		    DEFE_FRM_START_BIT(ENABLE))) {
-			printk("Could not start frontend.\n");
+		dev->cfg.input_fmt = FE_FORMAT_MB32_NV12;
+		dev->cfg.output_fmt = user_config.output_fmt;
+		dev->cfg.in_width = user_config.in_width;
+		dev->cfg.in_height = user_config.in_height;
+		dev->cfg.out_width = user_config.out_width;
+		dev->cfg.out_height = user_config.out_height;
+
+		if (sunxi_fe_build_regs(&dev->cfg,
+		    &dev->misc_geo, &dev->misc_regs, 1)) {
+			dev->misc_geo.nr_planes = 0;
+			mutex_unlock(&dev->node->job_lock);
+			printk("Error: Could not configure channels with "
+			    "current settings.\n");
 			return -1;
 		}
-		msleep(100);
-		if (regmap_write(sunxi_fe_dev->regs, DEFE_FRM_CTRL_REG,
-		    DEFE_REG_RDY_EN(ENABLE) | DEFE_COEF_RDY_EN(ENABLE) |
-		    DEFE_FRM_START_BIT(ENABLE))) {
+
+		if (sunxi_fe_load_coefs(dev, &dev->misc_regs))
+			printk("Frontend: could not load scaler filters.\n");
+		ret = fe_reg_image_apply(dev->regs,
+		    &dev->misc_regs, &dev->hw_regs);
+		if (ret < 0) {
+			mutex_unlock(&dev->node->job_lock);
+			printk("Error: Could not write configuration.\n");
+			return -1;
+		}
+
+		ret = sunxi_fe_apply_config(dev);
+		mutex_unlock(&dev->node->job_lock);
+		if (ret) {
 			printk("Could not start frontend.\n");
 			return -1;
 		}
@@ -754,8 +2813,9 @@ static long sunxi_fe_ioctl(struct file *filp, unsigned int cmd,
 
 		break;
 	case SFE_IOCTL_SET_INPUT:
-		sfe_ioctl_set_input(arg);
-		break;
+		return sfe_ioctl_set_input(dev, arg);
+	case SFE_IOCTL_SET_INPUT_DMABUF:
+		return sfe_ioctl_set_input_dmabuf(dev, arg);
 	default:
 		printk("Unsupported cmd used x0%x\n", cmd);
 		break;
@@ -763,11 +2823,40 @@ static long sunxi_fe_ioctl(struct file *filp, unsigned int cmd,
 	return 0;
 }
 
+/*
+ * The misc device writes the registers directly, so the front-end is kept
+ * powered while it is open.
+ */
+static int sunxi_fe_misc_open(struct inode *inode, struct file *filp)
+{
+	struct sunxi_fe_device *dev = sunxi_fe_file_dev(filp);
+	int ret;
+
+	ret = pm_runtime_get_sync(dev->dev);
+	if (ret < 0) {
+		pm_runtime_put_noidle(dev->dev);
+		return ret;
+	}
+
+	return 0;
+}
+
+static int sunxi_fe_misc_release(struct inode *inode, struct file *filp)
+{
+	struct sunxi_fe_device *dev = sunxi_fe_file_dev(filp);
+
+	pm_runtime_mark_last_busy(dev->dev);
+	pm_runtime_put_autosuspend(dev->dev);
+
+	return 0;
+}
+
 /* Queue operations */
 static int sunxi_de_fe_queue_setup(struct vb2_queue *vq, unsigned int *nbufs,
     unsigned int *nplanes, unsigned int sizes[], struct device *alloc_devs[])
 {
 	struct sunxi_de_fe_ctx *ctx;
+	unsigned int i;
 
 	ctx = vb2_get_drv_priv(vq);
 	PRINT_DE_FE("de_fe %s();\n", __FUNCTION__);
@@ -781,13 +2870,14 @@ static int sunxi_de_fe_queue_setup(struct vb2_queue *vq, unsigned int *nbufs,
 	switch (vq->type) {
 	case V4L2_BUF_TYPE_VIDEO_OUTPUT_MPLANE:
 		*nplanes = ctx->vpu_src_fmt->num_planes;
-		sizes[0] = ctx->src_fmt.plane_fmt[0].sizeimage;
+		for (i = 0; i < *nplanes; i++)
+			sizes[i] = ctx->src_fmt.plane_fmt[i].sizeimage;
 		break;
 	case V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE:
 		*nplanes = ctx->vpu_dst_fmt->num_planes;
-
-		sizes[0] = round_up(ctx->dst_fmt.plane_fmt[0].sizeimage, 8);
-		sizes[1] = sizes[0];
+		for (i = 0; i < *nplanes; i++)
+			sizes[i] = round_up(ctx->dst_fmt.plane_fmt[i].sizeimage,
+			    8);
 		break;
 	default:
 		PRINT_DE_FE("Frontend: invalid queue type: %d\n", vq->type);
@@ -797,15 +2887,160 @@ static int sunxi_de_fe_queue_setup(struct vb2_queue *vq, unsigned int *nbufs,
 	return 0;
 }
 
+static inline struct sunxi_fe_buffer *vb2_to_sunxi_fe_buffer(
+    struct vb2_buffer *vb)
+{
+
+	return container_of(to_vb2_v4l2_buffer(vb), struct sunxi_fe_buffer,
+	    m2m_buf.vb);
+}
+
+static void sunxi_fe_in_fence_cb(struct dma_fence *fence,
+    struct dma_fence_cb *cb)
+{
+	struct sunxi_fe_buffer *buf;
+
+	buf = container_of(cb, struct sunxi_fe_buffer, in_fence_cb);
+	schedule_work(&buf->in_fence_work);
+}
+
+/*
+ * sunxi_fe_buf_arm_fence() - waits for a fence of a source buffer
+ *
+ * The producer of an imported dma-buf, e.g. cedrus, attaches an exclusive
+ * fence to it while it writes the buffer. Returns true if the buffer has to
+ * wait for such a fence. Called with fence_lock held.
+ */
+static bool sunxi_fe_buf_arm_fence(struct sunxi_fe_buffer *buf)
+{
+	struct vb2_buffer *vb = &buf->m2m_buf.vb.vb2_buf;
+	struct dma_fence *fence;
+	unsigned int i;
+
+	if (vb->memory != VB2_MEMORY_DMABUF)
+		return false;
+
+	for (i = 0; i < vb->num_planes; i++) {
+		if (!vb->planes[i].dbuf)
+			continue;
+
+		fence = reservation_object_get_excl_rcu(
+		    vb->planes[i].dbuf->resv);
+		if (!fence)
+			continue;
+
+		if (!dma_fence_add_callback(fence, &buf->in_fence_cb,
+		    sunxi_fe_in_fence_cb)) {
+			buf->in_fence = fence;
+			return true;
+		}
+
+		/* Signalled already. */
+		dma_fence_put(fence);
+	}
+
+	return false;
+}
+
+/*
+ * sunxi_fe_queue_fenced() - hands the ready source buffers to the m2m core
+ *
+ * Buffers are handed over in queueing order, so a buffer whose fence
+ * signals early waits for the ones queued before it. Called with fence_lock
+ * held. Returns true if buffers were handed over.
+ */
+static bool sunxi_fe_queue_fenced(struct sunxi_de_fe_ctx *ctx)
+{
+	struct sunxi_fe_buffer *buf;
+	bool queued = false;
+
+	while (!list_empty(&ctx->fence_list)) {
+		buf = list_first_entry(&ctx->fence_list, struct sunxi_fe_buffer,
+		    in_fence_entry);
+		if (buf->in_fence)
+			break;
+
+		list_del_init(&buf->in_fence_entry);
+		v4l2_m2m_buf_queue(ctx->fh.m2m_ctx, &buf->m2m_buf.vb);
+		queued = true;
+	}
+
+	return queued;
+}
+
+static void sunxi_fe_in_fence_work(struct work_struct *work)
+{
+	struct sunxi_fe_buffer *buf;
+	struct sunxi_de_fe_ctx *ctx;
+	bool queued;
+
+	buf = container_of(work, struct sunxi_fe_buffer, in_fence_work);
+	ctx = vb2_get_drv_priv(buf->m2m_buf.vb.vb2_buf.vb2_queue);
+
+	spin_lock(&ctx->fence_lock);
+	/* Returned by stop_streaming meanwhile. */
+	if (list_empty(&buf->in_fence_entry)) {
+		spin_unlock(&ctx->fence_lock);
+		return;
+	}
+
+	dma_fence_put(buf->in_fence);
+	buf->in_fence = NULL;
+
+	/* Planes can carry fences of their own. */
+	sunxi_fe_buf_arm_fence(buf);
+	queued = sunxi_fe_queue_fenced(ctx);
+	spin_unlock(&ctx->fence_lock);
+
+	if (queued)
+		v4l2_m2m_try_schedule(ctx->fh.m2m_ctx);
+}
+
+/*
+ * sunxi_fe_cancel_fenced() - returns the source buffers waiting for a fence
+ */
+static void sunxi_fe_cancel_fenced(struct sunxi_de_fe_ctx *ctx)
+{
+	struct sunxi_fe_buffer *buf;
+
+	spin_lock(&ctx->fence_lock);
+	while (!list_empty(&ctx->fence_list)) {
+		buf = list_first_entry(&ctx->fence_list, struct sunxi_fe_buffer,
+		    in_fence_entry);
+		list_del_init(&buf->in_fence_entry);
+		spin_unlock(&ctx->fence_lock);
+
+		if (buf->in_fence)
+			dma_fence_remove_callback(buf->in_fence,
+			    &buf->in_fence_cb);
+		cancel_work_sync(&buf->in_fence_work);
+		if (buf->in_fence) {
+			dma_fence_put(buf->in_fence);
+			buf->in_fence = NULL;
+		}
+		sunxi_fe_buf_done(&buf->m2m_buf.vb, VB2_BUF_STATE_ERROR);
+
+		spin_lock(&ctx->fence_lock);
+	}
+	spin_unlock(&ctx->fence_lock);
+}
+
 static int sunxi_de_fe_buf_init(struct vb2_buffer *vb)
 {
+	struct sunxi_fe_buffer *buf;
 	struct vb2_queue *vq;
 	struct sunxi_de_fe_ctx *ctx;
 
 	vq = vb->vb2_queue;
 	ctx = container_of(vq->drv_priv, struct sunxi_de_fe_ctx, fh);
+	buf = vb2_to_sunxi_fe_buffer(vb);
 	PRINT_DE_FE("de_fe %s();\n", __FUNCTION__);
 
+	buf->in_fence = NULL;
+	buf->out_fence = NULL;
+	INIT_WORK(&buf->in_fence_work, sunxi_fe_in_fence_work);
+	INIT_LIST_HEAD(&buf->in_fence_entry);
+
 	if (vq->type == V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE)
 		ctx->dst_bufs[vb->index] = vb;
 
@@ -838,9 +3073,10 @@ static int sunxi_de_fe_buf_prepare(struct vb2_buffer *vb)
 
 	switch (vq->type) {
 	case V4L2_BUF_TYPE_VIDEO_OUTPUT_MPLANE:
-		if (vb2_plane_size(vb, 0) <
-		    ctx->src_fmt.plane_fmt[0].sizeimage)
-			return -EINVAL;
+		for (i = 0; i < ctx->vpu_src_fmt->num_planes; ++i)
+			if (vb2_plane_size(vb, i) <
+			    ctx->src_fmt.plane_fmt[i].sizeimage)
+				return -EINVAL;
 		break;
 
 	case V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE:
@@ -858,6 +3094,187 @@ static int sunxi_de_fe_buf_prepare(struct vb2_buffer *vb)
 	return 0;
 }
 
+/*
+ * sunxi_fe_node_get() - keeps the front-ends of node powered
+ *
+ * Each streaming queue holds a reference. The front-ends are resumed for the
+ * first one and suspend after the autosuspend delay once the last one is put.
+ */
+static int sunxi_fe_node_get(struct sunxi_fe_node *node)
+{
+	unsigned int i;
+	int ret = 0;
+
+	mutex_lock(&node->job_lock);
+	if (node->pm_users++)
+		goto out_unlock;
+
+	for (i = 0; i < node->nr_cores; i++) {
+		ret = pm_runtime_get_sync(node->cores[i]->dev);
+		if (ret < 0) {
+			printk("Frontend: could not resume %s\n",
+			    node->cores[i]->phys_name);
+			pm_runtime_put_noidle(node->cores[i]->dev);
+			while (i--)
+				pm_runtime_put_autosuspend(
+				    node->cores[i]->dev);
+			node->pm_users--;
+			goto out_unlock;
+		}
+	}
+	ret = 0;
+
+out_unlock:
+	mutex_unlock(&node->job_lock);
+	return ret;
+}
+
+static void sunxi_fe_node_put(struct sunxi_fe_node *node)
+{
+	unsigned int i;
+
+	mutex_lock(&node->job_lock);
+	if (!--node->pm_users) {
+		for (i = 0; i < node->nr_cores; i++) {
+			pm_runtime_mark_last_busy(node->cores[i]->dev);
+			pm_runtime_put_autosuspend(node->cores[i]->dev);
+		}
+	}
+	mutex_unlock(&node->job_lock);
+}
+
+/*
+ * sunxi_fe_direct_conflict() - whether ctx can not stream next to the others
+ *
+ * A direct context keeps the first front-end feeding the back-end until it
+ * stops. With a single front-end the other contexts would starve meanwhile,
+ * so direct and written back output do not stream at the same time. Called
+ * with job_lock held.
+ */
+static bool sunxi_fe_direct_conflict(struct sunxi_fe_node *node,
+    struct sunxi_de_fe_ctx *ctx)
+{
+	struct sunxi_de_fe_ctx *other;
+
+	if (node->nr_cores > 1)
+		return false;
+
+	list_for_each_entry(other, &node->stream_list, stream_entry)
+		if (other != ctx && other->direct != ctx->direct)
+			return true;
+
+	return false;
+}
+
+/*
+ * The conversion of a context is turned into its register image here, so that
+ * device_run() only has to write the registers that differ from the previous
+ * frame.
+ */
+static int sunxi_de_fe_start_streaming(struct vb2_queue *q, unsigned int count)
+{
+	struct sunxi_de_fe_ctx *ctx;
+	struct sunxi_fe_node *node;
+	struct vb2_v4l2_buffer *vbuf;
+	int ret;
+
+	ctx = vb2_get_drv_priv(q);
+	node = ctx->node;
+	PRINT_DE_FE("de_fe %s();\n", __FUNCTION__);
+
+	mutex_lock(&node->job_lock);
+	if (ctx->pending) {
+		ctx->cfg = ctx->pending_cfg;
+		ctx->pending = false;
+	}
+	ctx->cfg.input_fmt = ctx->vpu_src_fmt ?
+	    ctx->vpu_src_fmt->drm_fourcc : FE_FORMAT_MB32_NV12;
+	ctx->cfg.in_buffers = ctx->vpu_src_fmt ?
+	    ctx->vpu_src_fmt->num_planes : 0;
+	ctx->cfg.output_fmt = ctx->vpu_dst_fmt ?
+	    ctx->vpu_dst_fmt->drm_fourcc : DRM_FORMAT_XRGB8888;
+	ctx->cfg.out_buffers = ctx->vpu_dst_fmt ?
+	    ctx->vpu_dst_fmt->num_planes : 0;
+	ctx->cfg.in_width = ctx->src_fmt.width;
+	ctx->cfg.in_height = ctx->src_fmt.height;
+	ctx->cfg.field = sunxi_fe_field(ctx->src_fmt.field);
+	ctx->field = 0;
+	ctx->stripe = 0;
+	ctx->stripe_error = false;
+	ctx->target = 0;
+	ctx->nr_fanout = 0;
+	ctx->cfg.out_width = ctx->dst_fmt.width;
+	ctx->cfg.out_height = ctx->dst_fmt.height;
+	ctx->cfg.out_pitch = ctx->dst_fmt.plane_fmt[0].bytesperline;
+
+	/* The input of a fan-out target is set up by its source. */
+	if (sunxi_fe_fanout_target(ctx)) {
+		memset(&ctx->geo, 0, sizeof(ctx->geo));
+		ctx->fanout_dirty = true;
+		if (!ctx->cfg.out_width || !ctx->cfg.out_height) {
+			printk("Frontend: formats must be set before "
+			    "streaming\n");
+			ret = -EINVAL;
+		} else {
+			ret = 0;
+		}
+	} else if (!ctx->cfg.in_width || !ctx->cfg.in_height ||
+	    !ctx->cfg.out_width || !ctx->cfg.out_height) {
+		printk("Frontend: formats must be set before streaming\n");
+		ret = -EINVAL;
+	} else {
+		ret = sunxi_fe_build_regs(&ctx->cfg, &ctx->geo, ctx->regs,
+		    ctx->direct ? 1 : ARRAY_SIZE(ctx->regs)) ? -EINVAL : 0;
+	}
+
+	if (!ret && sunxi_fe_direct_conflict(node, ctx)) {
+		printk("Frontend: the front-end is busy with %s output\n",
+		    ctx->direct ? "written back" : "direct");
+		ret = -EBUSY;
+	}
+	if (!ret && !ctx->nr_streaming++)
+		list_add_tail(&ctx->stream_entry, &node->stream_list);
+	mutex_unlock(&node->job_lock);
+
+	/* The front-ends stay powered while a queue of the context streams. */
+	if (!ret) {
+		ret = sunxi_fe_node_get(node);
+		if (ret) {
+			mutex_lock(&node->job_lock);
+			if (!--ctx->nr_streaming)
+				list_del_init(&ctx->stream_entry);
+			mutex_unlock(&node->job_lock);
+		}
+	}
+
+	if (!ret) {
+		/* The clock is raised before the first frame is staged. */
+		mutex_lock(&node->job_lock);
+		sunxi_fe_node_set_rate(node);
+		mutex_unlock(&node->job_lock);
+
+		v4l2_ctrl_grab(ctx->direct_ctrl, true);
+		v4l2_ctrl_grab(ctx->fanout_ctrl, true);
+#ifdef HACK_BACKEND_LAYER2_TO_FRONTEND
+		/* Flipped at the next vblank, only if the size changed. */
+		sunxi_fe_plane_update(&node->cores[0]->plane, 0, 0,
+		    ctx->cfg.out_width, ctx->cfg.out_height);
+#endif
+		return 0;
+	}
+
+	while (1) {
+		if (V4L2_TYPE_IS_OUTPUT(q->type))
+			vbuf = v4l2_m2m_src_buf_remove(ctx->fh.m2m_ctx);
+		else
+			vbuf = v4l2_m2m_dst_buf_remove(ctx->fh.m2m_ctx);
+		if (!vbuf)
+			break;
+		sunxi_fe_buf_done(vbuf, VB2_BUF_STATE_QUEUED);
+	}
+	return ret;
+}
+
 static void sunxi_de_fe_stop_streaming(struct vb2_queue *q)
 {
 	struct sunxi_de_fe_ctx *ctx = vb2_get_drv_priv(q);
@@ -865,9 +3282,39 @@ static void sunxi_de_fe_stop_streaming(struct vb2_queue *q)
 
 	ctx = vb2_get_drv_priv(q);
 	PRINT_DE_FE("de_fe %s();\n", __FUNCTION__);
+
+	cancel_delayed_work_sync(&ctx->flush_work);
+	WRITE_ONCE(ctx->flush, false);
+	if (V4L2_TYPE_IS_OUTPUT(q->type)) {
+		sunxi_fe_cancel_fenced(ctx);
+	} else {
+		/* Sources must not pick the buffers of a stopped target. */
+		mutex_lock(&ctx->node->job_lock);
+		sunxi_fe_fanout_remove(ctx->node, ctx);
+		mutex_unlock(&ctx->node->job_lock);
+	}
+
+	/* Frames in flight hold buffers that are no longer on the queues. */
+	wait_event_timeout(ctx->node->frame_wq,
+	    !sunxi_fe_node_busy(ctx->node, ctx),
+	    msecs_to_jiffies(SUNXI_FE_JOB_TIMEOUT_MS));
+
 #ifdef HACK_BACKEND_LAYER2_TO_FRONTEND
-	hack_disable_be0_layer2_to_fe();
+	sunxi_fe_plane_disable(&ctx->node->cores[0]->plane);
 #endif
+	sunxi_fe_direct_stop(ctx->dev, ctx);
+
+	mutex_lock(&ctx->node->job_lock);
+	ctx->draining = false;
+	if (!--ctx->nr_streaming)
+		list_del_init(&ctx->stream_entry);
+	sunxi_fe_node_set_rate(ctx->node);
+	mutex_unlock(&ctx->node->job_lock);
+	sunxi_fe_node_put(ctx->node);
+	/* Also run from sunxi_fe_release(), before it frees the controls. */
+	v4l2_ctrl_grab(ctx->direct_ctrl, false);
+	v4l2_ctrl_grab(ctx->fanout_ctrl, false);
+
 	while (1) {
 		if (V4L2_TYPE_IS_OUTPUT(q->type))
 			vbuf = v4l2_m2m_src_buf_remove(ctx->fh.m2m_ctx);
@@ -876,22 +3323,57 @@ static void sunxi_de_fe_stop_streaming(struct vb2_queue *q)
 		if (!vbuf)
 			return;
 		// spin_lock_irqsave(&ctx->dev->irqlock, flags);
-		v4l2_m2m_buf_done(vbuf, VB2_BUF_STATE_ERROR);
+		sunxi_fe_buf_done(vbuf, VB2_BUF_STATE_ERROR);
 		// spin_unlock_irqrestore(&ctx->dev->irqlock, flags);
 	}
 
 }
 
+/*
+ * Source buffers are handed to the m2m core once the implicit fences of
+ * their dma-bufs have signalled, so a job is scheduled from the fence of the
+ * decoder without a round trip through userspace.
+ */
 static void sunxi_de_fe_buf_queue(struct vb2_buffer *vb)
 {
 	struct vb2_v4l2_buffer *vbuf;
 	struct sunxi_de_fe_ctx *ctx;
+	struct sunxi_fe_buffer *buf;
 
 	vbuf = to_vb2_v4l2_buffer(vb);
 	ctx = vb2_get_drv_priv(vb->vb2_queue);
+	buf = vb2_to_sunxi_fe_buffer(vb);
 	PRINT_DE_FE("de_fe %s();\n", __FUNCTION__);
 
+	/* A batch that is not filled up in time runs short. */
+	if (ctx->batch_size > 1)
+		mod_delayed_work(system_wq, &ctx->flush_work,
+		    msecs_to_jiffies(SUNXI_FE_FLUSH_TIMEOUT_MS));
+
+	if (V4L2_TYPE_IS_OUTPUT(vb->vb2_queue->type)) {
+		spin_lock(&ctx->fence_lock);
+		if (sunxi_fe_buf_arm_fence(buf) ||
+		    !list_empty(&ctx->fence_list)) {
+			list_add_tail(&buf->in_fence_entry, &ctx->fence_list);
+			spin_unlock(&ctx->fence_lock);
+			return;
+		}
+		spin_unlock(&ctx->fence_lock);
+	} else {
+		/* Only the buffer that ends a drain is the last one. */
+		vbuf->flags &= ~V4L2_BUF_FLAG_LAST;
+		sunxi_fe_buf_attach_fence(ctx, vbuf);
+	}
+
 	v4l2_m2m_buf_queue(ctx->fh.m2m_ctx, vbuf);
+
+	/* A drain waits for a capture buffer to mark the last one. */
+	if (!V4L2_TYPE_IS_OUTPUT(vb->vb2_queue->type) &&
+	    READ_ONCE(ctx->draining)) {
+		mutex_lock(&ctx->node->job_lock);
+		sunxi_fe_drain(ctx);
+		mutex_unlock(&ctx->node->job_lock);
+	}
 }
 
 static struct vb2_ops sunxi_de_fe_qops = {
@@ -900,6 +3382,7 @@ static struct vb2_ops sunxi_de_fe_qops = {
 	.buf_init	 = sunxi_de_fe_buf_init,
 	.buf_cleanup	 = sunxi_de_fe_buf_cleanup,
 	.buf_queue	 = sunxi_de_fe_buf_queue,
+	.start_streaming = sunxi_de_fe_start_streaming,
 	.stop_streaming  = sunxi_de_fe_stop_streaming,
 	.wait_prepare	 = vb2_ops_wait_prepare,
 	.wait_finish	 = vb2_ops_wait_finish,
@@ -917,13 +3400,13 @@ static int queue_init(void *priv, struct vb2_queue *src_vq,
 	src_vq->type = V4L2_BUF_TYPE_VIDEO_OUTPUT_MPLANE;
 	src_vq->io_modes = VB2_MMAP | VB2_DMABUF | VB2_USERPTR;
 	src_vq->drv_priv = ctx;
-	src_vq->buf_struct_size = sizeof(struct v4l2_m2m_buffer);
+	src_vq->buf_struct_size = sizeof(struct sunxi_fe_buffer);
 	src_vq->ops = &sunxi_de_fe_qops;
 	src_vq->mem_ops = &vb2_dma_contig_memops;
 	src_vq->timestamp_flags = V4L2_BUF_FLAG_TIMESTAMP_COPY;
 	// src_vq->lock = &ctx->dev->dev_mutex;
 	src_vq->v4l2_allow_requests = true;
-	src_vq->dev = ctx->dev->dev;
+	src_vq->dev = ctx->node->dev;
 
 	ret = vb2_queue_init(src_vq);
 	if (ret)
@@ -932,26 +3415,26 @@ static int queue_init(void *priv, struct vb2_queue *src_vq,
 	dst_vq->type = V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE;
 	dst_vq->io_modes = VB2_MMAP | VB2_DMABUF | VB2_USERPTR;
 	dst_vq->drv_priv = ctx;
-	dst_vq->buf_struct_size = sizeof(struct v4l2_m2m_buffer);
+	dst_vq->buf_struct_size = sizeof(struct sunxi_fe_buffer);
 	dst_vq->ops = &sunxi_de_fe_qops;
 	dst_vq->mem_ops = &vb2_dma_contig_memops;
 	dst_vq->timestamp_flags = V4L2_BUF_FLAG_TIMESTAMP_COPY;
 	// dst_vq->lock = &ctx->dev->dev_mutex;
 	dst_vq->v4l2_allow_requests = true;
-	dst_vq->dev = ctx->dev->dev;
+	dst_vq->dev = ctx->node->dev;
 
 	return vb2_queue_init(dst_vq);
 }
 
 static int sunxi_fe_open(struct file *file)
 {
-	struct sunxi_fe_device *dev;
+	struct sunxi_fe_node *node;
 	struct sunxi_de_fe_ctx *ctx = NULL;
 	struct v4l2_ctrl_handler *hdl;
 	uint32_t i;
 	int ret = 0;
 
-	dev = video_drvdata(file);
+	node = video_drvdata(file);
 	PRINT_DE_FE("de_fe %s();\n", __FUNCTION__);
 
 	ctx = kzalloc(sizeof(*ctx), GFP_KERNEL);
@@ -962,9 +3445,22 @@ static int sunxi_fe_open(struct file *file)
 
 	v4l2_fh_init(&ctx->fh, video_devdata(file));
 	file->private_data = &ctx->fh;
-	ctx->dev = dev;
+	ctx->node = node;
+	ctx->dev = node->cores[0];
+	ctx->batch_size = 1;
+	INIT_DELAYED_WORK(&ctx->flush_work, sunxi_fe_flush_work);
+	spin_lock_init(&ctx->fence_lock);
+	ctx->out_fence_context = dma_fence_context_alloc(1);
+	INIT_LIST_HEAD(&ctx->fence_list);
+	INIT_LIST_HEAD(&ctx->fanout_entry);
+	INIT_LIST_HEAD(&ctx->stream_entry);
 	hdl = &ctx->hdl;
-	v4l2_ctrl_handler_init(hdl, 1);
+	v4l2_ctrl_handler_init(hdl, 3);
+	v4l2_ctrl_new_custom(hdl, &sunxi_de_fe_ctrl_batch_size, NULL);
+	ctx->direct_ctrl = v4l2_ctrl_new_custom(hdl,
+	    &sunxi_de_fe_ctrl_direct_output, NULL);
+	ctx->fanout_ctrl = v4l2_ctrl_new_custom(hdl,
+	    &sunxi_de_fe_ctrl_fanout_group, NULL);
 
 	if (hdl->error) {
 		ret = hdl->error;
@@ -974,7 +3470,7 @@ static int sunxi_fe_open(struct file *file)
 	ctx->fh.ctrl_handler = hdl;
 	v4l2_ctrl_handler_setup(hdl);
 
-	ctx->fh.m2m_ctx = v4l2_m2m_ctx_init(dev->m2m_dev, ctx, &queue_init);
+	ctx->fh.m2m_ctx = v4l2_m2m_ctx_init(node->m2m_dev, ctx, &queue_init);
 
 	if (IS_ERR(ctx->fh.m2m_ctx)) {
 		ret = PTR_ERR(ctx->fh.m2m_ctx);
@@ -986,24 +3482,6 @@ static int sunxi_fe_open(struct file *file)
 
 	v4l2_fh_add(&ctx->fh);
 
-	if (regmap_update_bits(sunxi_fe_dev->regs, DEFE_EN_REG,
-	    DEFE_EN_MASK, DEFE_EN_BIT(ENABLE)) == -EIO) {
-		printk("Could not enable front end\n");
-		return -1;
-	}
-
-	if (setup_csc(sunxi_fe_dev) < 0) {
-		printk("Error: Could not configure color space converter with "
-		    "current settings.\n");
-		return -1;
-	}
-
-	if (regmap_write(sunxi_fe_dev->regs, DEFE_FRM_CTRL_REG,
-	    DEFE_COEF_RDY_EN(ENABLE))) {
-		printk("Could not mark coef regs rdy.\n");
-		return -1;
-	}
-
 	PRINT_DE_FE("Opened de fe device\n");
 	return 0;
 
@@ -1014,28 +3492,31 @@ open_unlock:
 
 static int sunxi_fe_release(struct file *file)
 {
-	struct sunxi_de_fe_dev *dev;
+	struct sunxi_fe_node *node;
 	struct sunxi_de_fe_ctx *ctx;
 	uint32_t i, max_buffer_size;
 
-	dev = video_drvdata(file);
+	node = video_drvdata(file);
 	ctx = container_of(file->private_data, struct sunxi_de_fe_ctx, fh);
 	PRINT_DE_FE("de_fe %s();\n", __FUNCTION__);
 
-	if (regmap_update_bits(sunxi_fe_dev->regs, DEFE_EN_REG,
-	    DEFE_EN_MASK, DEFE_EN_BIT(DISABLE)) == -EIO) {
-		printk("Could not enable front end\n");
-		return -1;
-	}
+	cancel_delayed_work_sync(&ctx->flush_work);
+	/*
+	 * Releasing the queues stops streaming, which still uses the controls
+	 * and the file handle, so those go last.
+	 */
+	// mutex_lock(&dev->dev_mutex);
+	v4l2_m2m_ctx_release(ctx->fh.m2m_ctx);
+	// mutex_unlock(&dev->dev_mutex);
+	mutex_lock(&node->job_lock);
+	list_del(&ctx->fanout_entry);
+	mutex_unlock(&node->job_lock);
 
 	v4l2_fh_del(&ctx->fh);
 	v4l2_fh_exit(&ctx->fh);
 	v4l2_ctrl_handler_free(&ctx->hdl);
 	ctx->mpeg2_frame_hdr_ctrl = NULL;
 	ctx->mpeg4_frame_hdr_ctrl = NULL;
-	// mutex_lock(&dev->dev_mutex);
-	v4l2_m2m_ctx_release(ctx->fh.m2m_ctx);
-	// mutex_unlock(&dev->dev_mutex);
 	kfree(ctx);
 
 	return 0;
@@ -1049,6 +3530,26 @@ static ssize_t proc_sunxi_de_fe_write(struct file *filp, const char *buf,
 	return count;
 }
 
+/*
+ * sunxi_fe_sync_regs() - writes the register cache back to the hardware
+ *
+ * Needed whenever the hardware lost its state, after a reset or when the
+ * clocks have been off.
+ */
+static int sunxi_fe_sync_regs(struct sunxi_fe_device *sunxi_fe_dev)
+{
+	int ret;
+
+	regcache_mark_dirty(sunxi_fe_dev->regs);
+	ret = regcache_sync(sunxi_fe_dev->regs);
+	if (ret)
+		return ret;
+
+	/* The coefficient RAM is only used after it has been marked ready. */
+	return regmap_update_bits(sunxi_fe_dev->regs, DEFE_FRM_CTRL_REG,
+	    DEFE_COEF_RDY_EN(ENABLE), DEFE_COEF_RDY_EN(ENABLE));
+}
+
 static int sunxi_fe_regmap_init(struct sunxi_fe_device *sunxi_fe_dev,
     struct platform_device *pdev) {
 	struct resource *res;
@@ -1073,15 +3574,392 @@ static int sunxi_fe_regmap_init(struct sunxi_fe_device *sunxi_fe_dev,
 	return 0;
 }
 
+/*
+ * sunxi_fe_core_id() - returns the instance of a front-end
+ *
+ * Taken from the frontend alias in the device tree, else the first free one.
+ * Called with sunxi_fe_cores_lock held.
+ */
+static int sunxi_fe_core_id(struct platform_device *pdev)
+{
+	int id;
+
+	id = of_alias_get_id(pdev->dev.of_node, "frontend");
+	if (id >= 0)
+		return id < SUNXI_FE_MAX_CORES && !sunxi_fe_cores[id] ?
+		    id : -EBUSY;
+
+	for (id = 0; id < SUNXI_FE_MAX_CORES; id++)
+		if (!sunxi_fe_cores[id])
+			return id;
+
+	return -EBUSY;
+}
+
+/*
+ * sunxi_fe_node_create() - sets up a video device for front-end jobs
+ *
+ * Buffers are allocated for dev, so it is held until the node is released.
+ * The video device is registered by sunxi_fe_node_attach() once the node has
+ * a front-end.
+ */
+static struct sunxi_fe_node *sunxi_fe_node_create(struct device *dev)
+{
+	struct sunxi_fe_node *node;
+	int ret;
+
+	node = kzalloc(sizeof(*node), GFP_KERNEL);
+	if (!node)
+		return ERR_PTR(-ENOMEM);
+
+	node->dev = get_device(dev);
+	init_waitqueue_head(&node->frame_wq);
+	spin_lock_init(&node->fence_lock);
+	mutex_init(&node->job_lock);
+	INIT_LIST_HEAD(&node->fanout_list);
+	INIT_LIST_HEAD(&node->stream_list);
+
+	ret = v4l2_device_register(dev, &node->v4l2_dev);
+	if (ret)
+		goto err_free;
+
+	node->m2m_dev = v4l2_m2m_init(&m2m_ops);
+	if (IS_ERR(node->m2m_dev)) {
+		printk("Frontend: Failed to init mem2mem device\n");
+		ret = PTR_ERR(node->m2m_dev);
+		goto err_unreg_dev;
+	}
+
+	node->vfd = sunxi_de_fe_viddev;
+	// node->vfd.lock = &node->dev_mutex;
+	// TODO Enable IRQ ^
+	node->vfd.v4l2_dev = &node->v4l2_dev;
+	video_set_drvdata(&node->vfd, node);
+
+	return node;
+
+err_unreg_dev:
+	v4l2_device_unregister(&node->v4l2_dev);
+err_free:
+	put_device(node->dev);
+	kfree(node);
+	return ERR_PTR(ret);
+}
+
+static void sunxi_fe_node_release(struct sunxi_fe_node *node)
+{
+
+	v4l2_m2m_release(node->m2m_dev);
+	v4l2_device_unregister(&node->v4l2_dev);
+	put_device(node->dev);
+	kfree(node);
+}
+
+/*
+ * sunxi_fe_node_attach() - lets a front-end run the jobs of a video device
+ *
+ * Without aggregation every front-end gets a video device of its own, else
+ * the first one registers the shared video device and the others join it.
+ * Called with sunxi_fe_cores_lock held.
+ */
+static int sunxi_fe_node_attach(struct sunxi_fe_device *dev)
+{
+	struct sunxi_fe_node *node;
+	unsigned int i;
+	int ret;
+
+	if (aggregate && sunxi_fe_shared_node) {
+		node = sunxi_fe_shared_node;
+
+		mutex_lock(&node->job_lock);
+		for (i = node->nr_cores++; i && node->cores[i - 1]->id >
+		    dev->id; i--)
+			node->cores[i] = node->cores[i - 1];
+		node->cores[i] = dev;
+		dev->node = node;
+		/* Streams may already run, the new front-end joins them. */
+		if (node->pm_users)
+			pm_runtime_get_noresume(dev->dev);
+		mutex_unlock(&node->job_lock);
+
+		printk("Frontend: %s joined /dev/video%d\n", dev->phys_name,
+		    node->vfd.num);
+		return 0;
+	}
+
+	node = sunxi_fe_node_create(dev->dev);
+	if (IS_ERR(node))
+		return PTR_ERR(node);
+
+	node->cores[node->nr_cores++] = dev;
+	dev->node = node;
+
+	ret = video_register_device(&node->vfd, VFL_TYPE_GRABBER, 0);
+	if (ret) {
+		dev->node = NULL;
+		sunxi_fe_node_release(node);
+		return ret;
+	}
+
+	snprintf(node->vfd.name, sizeof(node->vfd.name), "%s",
+	    sunxi_de_fe_viddev.name);
+	printk("Frontend: Device registered as /dev/video%d\n",
+	    node->vfd.num);
+
+	if (aggregate)
+		sunxi_fe_shared_node = node;
+
+	return 0;
+}
+
+/*
+ * sunxi_fe_core_idle() - whether dev has no frames in flight but a direct one
+ */
+static bool sunxi_fe_core_idle(struct sunxi_fe_device *dev)
+{
+	unsigned long flags;
+	bool idle;
+
+	spin_lock_irqsave(&dev->irqlock, flags);
+	idle = !sunxi_fe_frame_pending(dev) && !dev->done.ctx;
+	spin_unlock_irqrestore(&dev->irqlock, flags);
+
+	return idle;
+}
+
+/*
+ * sunxi_fe_node_detach() - stops a front-end from running jobs
+ *
+ * No frames are staged on dev anymore while it finishes the ones it holds; a
+ * direct frame is ended. The contexts whose last frame ran on dev move to the
+ * first front-end left. The video device goes with its last front-end. Called
+ * with sunxi_fe_cores_lock held.
+ */
+static void sunxi_fe_node_detach(struct sunxi_fe_device *dev)
+{
+	struct sunxi_fe_node *node = dev->node;
+	struct sunxi_de_fe_ctx *ctx;
+	struct v4l2_fh *fh;
+	unsigned long flags;
+	unsigned int i;
+
+	mutex_lock(&node->job_lock);
+	dev->detaching = true;
+	mutex_unlock(&node->job_lock);
+
+	/* The irq thread and the watchdog take job_lock, so wait without. */
+	if (!wait_event_timeout(node->frame_wq, sunxi_fe_core_idle(dev),
+	    msecs_to_jiffies(2 * SUNXI_FE_JOB_TIMEOUT_MS)))
+		printk("Frontend: %s still busy while detached\n",
+		    dev->phys_name);
+
+	spin_lock_irqsave(&dev->irqlock, flags);
+	ctx = dev->active.direct ? dev->active.ctx : NULL;
+	spin_unlock_irqrestore(&dev->irqlock, flags);
+	if (ctx)
+		sunxi_fe_direct_stop(dev, ctx);
+	synchronize_irq(dev->irq);
+
+	mutex_lock(&node->job_lock);
+	for (i = 0; node->cores[i] != dev; i++)
+		;
+	for (node->nr_cores--; i < node->nr_cores; i++)
+		node->cores[i] = node->cores[i + 1];
+	if (node->pm_users)
+		pm_runtime_put_noidle(dev->dev);
+
+	if (node->nr_cores) {
+		spin_lock_irqsave(&node->vfd.fh_lock, flags);
+		list_for_each_entry(fh, &node->vfd.fh_list, list) {
+			ctx = container_of(fh, struct sunxi_de_fe_ctx, fh);
+			if (ctx->dev == dev)
+				ctx->dev = node->cores[0];
+		}
+		spin_unlock_irqrestore(&node->vfd.fh_lock, flags);
+	}
+	mutex_unlock(&node->job_lock);
+
+	if (node->nr_cores) {
+		/* Frames that waited for dev go to the others. */
+		sunxi_fe_stage_next(node);
+		return;
+	}
+
+	video_unregister_device(&node->vfd);
+	if (node == sunxi_fe_shared_node)
+		sunxi_fe_shared_node = NULL;
+	sunxi_fe_node_release(node);
+}
+
+/*
+ * sunxi_fe_runtime_suspend() - gates the clocks and holds the front-end in
+ * reset
+ *
+ * Register writes only go to the register cache while suspended.
+ */
+static int sunxi_fe_runtime_suspend(struct device *dev)
+{
+	struct sunxi_fe_device *sunxi_fe_dev = dev_get_drvdata(dev);
+
+	regcache_cache_only(sunxi_fe_dev->regs, true);
+	clk_disable_unprepare(sunxi_fe_dev->mod_clk);
+	clk_disable_unprepare(sunxi_fe_dev->ram_clk);
+	clk_disable_unprepare(sunxi_fe_dev->ahb_clk);
+	reset_control_assert(sunxi_fe_dev->reset);
+
+	return 0;
+}
+
+/*
+ * sunxi_fe_runtime_resume() - powers the front-end and restores its registers
+ *
+ * The register cache restores the scaler coefficients and the color space
+ * conversion with all other registers in one pass, so the loaded filters and
+ * hw_regs stay valid and the first frame is staged as usual.
+ */
+static int sunxi_fe_runtime_resume(struct device *dev)
+{
+	struct sunxi_fe_device *sunxi_fe_dev = dev_get_drvdata(dev);
+	int ret;
+
+	ret = reset_control_deassert(sunxi_fe_dev->reset);
+	if (ret)
+		return ret;
+
+	ret = clk_prepare_enable(sunxi_fe_dev->ahb_clk);
+	if (ret)
+		goto err_assert_reset;
+	ret = clk_prepare_enable(sunxi_fe_dev->ram_clk);
+	if (ret)
+		goto err_disable_ahb_clk;
+	ret = clk_prepare_enable(sunxi_fe_dev->mod_clk);
+	if (ret)
+		goto err_disable_ram_clk;
+
+	regcache_cache_only(sunxi_fe_dev->regs, false);
+	ret = sunxi_fe_sync_regs(sunxi_fe_dev);
+	if (ret) {
+		printk("Frontend: could not restore registers on resume\n");
+		goto err_disable_mod_clk;
+	}
+
+	return 0;
+
+err_disable_mod_clk:
+	regcache_cache_only(sunxi_fe_dev->regs, true);
+	clk_disable_unprepare(sunxi_fe_dev->mod_clk);
+err_disable_ram_clk:
+	clk_disable_unprepare(sunxi_fe_dev->ram_clk);
+err_disable_ahb_clk:
+	clk_disable_unprepare(sunxi_fe_dev->ahb_clk);
+err_assert_reset:
+	reset_control_assert(sunxi_fe_dev->reset);
+	return ret;
+}
+
+#ifdef CONFIG_PROC_FS
+/*
+ * sunxi_fe_proc_create() - adds the proc file of the misc device of dev
+ *
+ * Called with sunxi_fe_cores_lock held.
+ */
+static int sunxi_fe_proc_create(struct sunxi_fe_device *dev)
+{
+
+	// Create the proc entry with permissions 666 (rw, rw, rw)
+	sunxi_fe_proc_entry = proc_create_data(FRONT_END_MODULE_NAME,
+	    S_IRUGO | S_IWUGO, NULL, &sunxi_fe_fops, dev);
+	if (!sunxi_fe_proc_entry) {
+		printk("Failed adding sunxi front end proc entry\n");
+		return -ENOMEM;
+	}
+	sunxi_fe_proc_dev = dev;
+
+	return 0;
+}
+
+/*
+ * sunxi_fe_proc_get() - adds the proc file and sysctls for the first user
+ *
+ * Called with sunxi_fe_cores_lock held.
+ */
+static int sunxi_fe_proc_get(struct sunxi_fe_device *dev)
+{
+	int ret;
+
+	if (sunxi_fe_proc_users)
+		goto out;
+
+	ret = sunxi_fe_proc_create(dev);
+	if (ret)
+		return ret;
+
+	sunxi_de_fe_table_header = register_sysctl_table(
+	    sunxi_de_fe_root_table);
+	if (!sunxi_de_fe_table_header) {
+		proc_remove(sunxi_fe_proc_entry);
+		sunxi_fe_proc_entry = NULL;
+		sunxi_fe_proc_dev = NULL;
+		return -ENOMEM;
+	}
+
+	/* Thomas: Create a /proc entry.
+	 * Inspired by linux-sunxi/drivers/media/pci/zoran/videocodec.c
+	 * CONFIG_PROC_FS seems to be needed in config. */
+	printk("Thomas: adding sunxi_de_fe /proc entry.\n");
+
+	// 10 is probebly enough
+	de_fe_msg = kmalloc(GFP_KERNEL, 10 * sizeof(char));
+
+out:
+	sunxi_fe_proc_users++;
+	return 0;
+}
+
+/*
+ * sunxi_fe_proc_put() - drops a user of the proc file and sysctls
+ *
+ * The proc file serves the misc device of one front-end. When that one goes
+ * while others stay, it is added again for one of them. proc_remove() waits
+ * for the calls in progress. Called with sunxi_fe_cores_lock held.
+ */
+static void sunxi_fe_proc_put(struct sunxi_fe_device *dev)
+{
+	unsigned int i;
+
+	if (!--sunxi_fe_proc_users) {
+		proc_remove(sunxi_fe_proc_entry);
+		sunxi_fe_proc_entry = NULL;
+		sunxi_fe_proc_dev = NULL;
+		unregister_sysctl_table(sunxi_de_fe_table_header);
+		sunxi_de_fe_table_header = NULL;
+		kfree(de_fe_msg);
+		de_fe_msg = NULL;
+		return;
+	}
+
+	if (sunxi_fe_proc_dev != dev)
+		return;
+
+	proc_remove(sunxi_fe_proc_entry);
+	sunxi_fe_proc_entry = NULL;
+	sunxi_fe_proc_dev = NULL;
+	for (i = 0; i < SUNXI_FE_MAX_CORES; i++)
+		if (sunxi_fe_cores[i] && sunxi_fe_cores[i] != dev)
+			break;
+	if (i < SUNXI_FE_MAX_CORES)
+		sunxi_fe_proc_create(sunxi_fe_cores[i]);
+}
+#endif /* CONFIG_PROC_FS */
+
 /* Platform driver setup
  * https://lwn.net/Articles/448499/
  */
 static int sunxi_fe_probe(struct platform_device *pdev)
 {
-	struct video_device *vfd;
-	uint32_t i, offset;
-	void __iomem *regs;
-	int ret;
+	struct sunxi_fe_device *sunxi_fe_dev;
+	struct regmap *regs;
+	int i, ret;
 
 	printk("sunxi front end probe");
 
@@ -1092,7 +3970,7 @@ static int sunxi_fe_probe(struct platform_device *pdev)
 		return -ENOMEM;
 	}
 
-	// platform_set_drvdata(pdev, sunxi_fe_dev);
+	platform_set_drvdata(pdev, sunxi_fe_dev);
 	sunxi_fe_dev->dev = &pdev->dev;
 	sunxi_fe_dev->phys_name = dev_name(&pdev->dev);
 
@@ -1106,6 +3984,12 @@ static int sunxi_fe_probe(struct platform_device *pdev)
 		return PTR_ERR(sunxi_fe_dev->reset);
 	}
 
+	/*
+	 * Released from a fresh reset, so the hardware holds the reset
+	 * values the register cache starts from, whatever the boot loader
+	 * left behind.
+	 */
+	reset_control_assert(sunxi_fe_dev->reset);
 	ret = reset_control_deassert(sunxi_fe_dev->reset);
 	if (ret) {
 		printk("Could not deassert our reset line\n");
@@ -1149,108 +4033,125 @@ static int sunxi_fe_probe(struct platform_device *pdev)
 		printk("failed to prepare enable mod_clk\n");
 		goto err_disable_ram_clk;
 	}
+	/* Full rate until streams ask for less. */
+	sunxi_fe_core_set_rate(sunxi_fe_dev, SUNXI_FE_MAX_MOD_RATE);
 
-	// Add /dev/sunxi_front_end entry
-	fe_miscdevice.minor = MISC_DYNAMIC_MINOR;
-	fe_miscdevice.name = FRONT_END_MODULE_NAME;
-	fe_miscdevice.fops = &sunxi_fe_fops;
-	fe_miscdevice.parent = get_device(&pdev->dev);
-	ret = misc_register(&fe_miscdevice);
-	if (ret != 0) {
-		printk("Error registering misc device\n");
+	spin_lock_init(&sunxi_fe_dev->irqlock);
+	fe_coef_cache_init(&sunxi_fe_dev->coef_cache);
+	INIT_DELAYED_WORK(&sunxi_fe_dev->watchdog_work, sunxi_fe_watchdog);
+
+	sunxi_fe_dev->irq = platform_get_irq(pdev, 0);
+	if (sunxi_fe_dev->irq < 0) {
+		printk("Could not get irq\n");
+		ret = sunxi_fe_dev->irq;
 		goto err_disable_mod_clk;
 	}
 
-	ret = v4l2_device_register(&pdev->dev, &sunxi_fe_dev->v4l2_dev);
-	if (ret)
-		return ret;
+	ret = devm_request_threaded_irq(&pdev->dev, sunxi_fe_dev->irq,
+	    sunxi_fe_irq, sunxi_fe_irq_thread, IRQF_ONESHOT,
+	    dev_name(&pdev->dev), sunxi_fe_dev);
+	if (ret) {
+		printk("Could not request irq %d\n", sunxi_fe_dev->irq);
+		goto err_disable_mod_clk;
+	}
 
-	sunxi_fe_dev->vfd = sunxi_de_fe_viddev;
-	vfd = &sunxi_fe_dev->vfd;
-	// vfd->lock = &sunxi_fe_dev->dev_mutex;
-	// TODO Enable IRQ ^
-	vfd->v4l2_dev = &sunxi_fe_dev->v4l2_dev;
+	/*
+	 * Enabled for good, runtime PM gates the clocks instead. The register
+	 * cache restores the enable with everything else on resume.
+	 */
+	regs = sunxi_fe_dev->regs;
+	regmap_update_bits(regs, DEFE_EN_REG, DEFE_EN_MASK,
+	    DEFE_EN_BIT(ENABLE));
 
-	ret = video_register_device(vfd, VFL_TYPE_GRABBER, 0);
+	/* Set the horizontal and vertical coef */
+	ret = fe_coef_upload_all(regs, &fe_coef_sun4i, &fe_coef_sun4i);
 	if (ret)
-		goto unreg_dev;
-
-	video_set_drvdata(vfd, sunxi_fe_dev);
-	snprintf(vfd->name, sizeof(vfd->name), "%s", sunxi_de_fe_viddev.name);
-	printk("Frontend: Device registered as /dev/video%d\n", vfd->num);
-
-	sunxi_fe_dev->m2m_dev = v4l2_m2m_init(&m2m_ops);
-	if (IS_ERR(sunxi_fe_dev->m2m_dev)) {
-		printk("Frontend: Failed to init mem2mem device\n");
-		ret = PTR_ERR(sunxi_fe_dev->m2m_dev);
-		goto err_m2m;
+		printk("Could not set the scaler coefficients\n");
+	for (i = 0; i < DEFE_NR_COEF_CHANNELS; i++) {
+		sunxi_fe_dev->coef_keys[i][FE_COEF_DIR_HORZ] =
+		    fe_coef_key(FE_COEF_DIR_HORZ, 1 << 16);
+		sunxi_fe_dev->coef_keys[i][FE_COEF_DIR_VERT] =
+		    fe_coef_key(FE_COEF_DIR_VERT, 1 << 16);
 	}
 
-#ifdef CONFIG_PROC_FS
-	// Create the proc entry with permissions 666 (rw, rw, rw)
-	sunxi_fe_proc_entry = proc_create(FRONT_END_MODULE_NAME, S_IRUGO |
-	    S_IWUGO, NULL, &sunxi_fe_fops);
-	if (sunxi_fe_proc_entry == NULL) {
-		printk("Failed adding sunxi front end proc entry\n");
-		ret = -1;
-		goto err_disable_mod_clk;
+	/* Clear stale status before enabling the write-back interrupt. */
+	regmap_write(regs, DEFE_INT_STATUS_REG, DEFE_WB_INT_STATUS);
+	regmap_update_bits(regs, DEFE_INT_EN_REG, DEFE_WB_INT_EN_MASK,
+	    DEFE_WB_INT_EN(ENABLE));
+
+	/* Powered until the end of the probe, then idle until first used. */
+	pm_runtime_set_active(&pdev->dev);
+	pm_runtime_use_autosuspend(&pdev->dev);
+	pm_runtime_set_autosuspend_delay(&pdev->dev, SUNXI_FE_AUTOSUSPEND_MS);
+	pm_runtime_get_noresume(&pdev->dev);
+	pm_runtime_enable(&pdev->dev);
+
+	mutex_lock(&sunxi_fe_cores_lock);
+	ret = sunxi_fe_core_id(pdev);
+	if (ret < 0) {
+		printk("Frontend: no free instance\n");
+		goto err_unlock;
+	}
+	sunxi_fe_dev->id = ret;
+
+	/* Layer 2 of the first back-end is fed by the first front-end. */
+	if (!sunxi_fe_dev->id &&
+	    sunxi_fe_plane_init(&pdev->dev, &sunxi_fe_dev->plane))
+		printk("Could not map the back-end, no overlay plane\n");
+
+	// Add /dev/sunxi_front_end entry, numbered from the second instance
+	if (sunxi_fe_dev->id)
+		snprintf(sunxi_fe_dev->misc_name,
+		    sizeof(sunxi_fe_dev->misc_name), "%s%u",
+		    FRONT_END_MODULE_NAME, sunxi_fe_dev->id);
+	else
+		strlcpy(sunxi_fe_dev->misc_name, FRONT_END_MODULE_NAME,
+		    sizeof(sunxi_fe_dev->misc_name));
+	sunxi_fe_dev->misc.minor = MISC_DYNAMIC_MINOR;
+	sunxi_fe_dev->misc.name = sunxi_fe_dev->misc_name;
+	sunxi_fe_dev->misc.fops = &sunxi_fe_fops;
+	sunxi_fe_dev->misc.parent = &pdev->dev;
+	ret = misc_register(&sunxi_fe_dev->misc);
+	if (ret != 0) {
+		printk("Error registering misc device\n");
+		goto err_unlock;
 	}
 
-	sunxi_de_fe_table_header = register_sysctl_table(
-	    sunxi_de_fe_root_table);
-
-        if (!sunxi_de_fe_table_header)
-                return -ENOMEM;
-
-        /* Thomas: Create a /proc entry.
-         * Inspired by linux-sunxi/drivers/media/pci/zoran/videocodec.c
-         * CONFIG_PROC_FS seems to be needed in config. */
-         printk("Thomas: adding sunxi_de_fe /proc entry.\n");
-
-         /* from include/linux/proc_fs.h
-          * static inline struct proc_dir_entry *proc_create(
-          *     const char *name, umode_t mode, struct proc_dir_entry *parent,
-          *     const struct file_operations *proc_fops)
-          * {
-          *     return proc_create_data(name, mode, parent, proc_fops, NULL);
-          * }
-          */
+#ifdef CONFIG_PROC_FS
+	ret = sunxi_fe_proc_get(sunxi_fe_dev);
+	if (ret)
+		goto err_misc;
+#endif /* CONFIG_PROC_FS */
 
-	// 10 is probebly enough
-	de_fe_msg = kmalloc(GFP_KERNEL, 10 * sizeof(char));
+	ret = sunxi_fe_node_attach(sunxi_fe_dev);
+	if (ret)
+		goto err_proc;
 
-#endif /* CONFIG_PROC_FS */
+	sunxi_fe_cores[sunxi_fe_dev->id] = sunxi_fe_dev;
+	mutex_unlock(&sunxi_fe_cores_lock);
 
-	/* Set the horizontal and vertical coef */
-	regs = sunxi_fe_dev->regs;
-	for (i = 0; i < 32; i++) {
-		offset = i * 0x4; //size of register = 0x4
-		regmap_write(regs, DEFE_CH0_HORZCOEF0 + offset,
-		    sun4i_horz_coef[2 * i]);
-		regmap_write(regs, DEFE_CH0_HORZCOEF1 + offset,
-		    sun4i_horz_coef[2 * i + 1]);
-		regmap_write(regs, DEFE_CH0_VERTCOEF + offset,
-		    sun4i_vert_coef[i]);
-		regmap_write(regs, DEFE_CH1_HORZCOEF0 + offset,
-		    sun4i_horz_coef[2 * i]);
-		regmap_write(regs, DEFE_CH1_HORZCOEF1 + offset,
-		    sun4i_horz_coef[2 * i + 1]);
-		regmap_write(regs, DEFE_CH0_VERTCOEF + offset,
-		    sun4i_vert_coef[i]);
-	}
-
-	regmap_write(regs, DEFE_FRM_CTRL_REG,
-	    DEFE_COEF_RDY_EN(1));
-
-	printk("Successfully added sunxi front end device\n");
+	pm_runtime_mark_last_busy(&pdev->dev);
+	pm_runtime_put_autosuspend(&pdev->dev);
+	printk("Successfully added sunxi front end device %u\n",
+	    sunxi_fe_dev->id);
 
 	return 0;
 
-err_m2m:
-	v4l2_m2m_release(sunxi_fe_dev->m2m_dev);
-	video_unregister_device(&sunxi_fe_dev->vfd);
-unreg_dev:
-	v4l2_device_unregister(&sunxi_fe_dev->v4l2_dev);
+err_proc:
+#ifdef CONFIG_PROC_FS
+	sunxi_fe_proc_put(sunxi_fe_dev);
+#endif /* CONFIG_PROC_FS */
+err_misc:
+	misc_deregister(&sunxi_fe_dev->misc);
+err_unlock:
+	mutex_unlock(&sunxi_fe_cores_lock);
+	pm_runtime_disable(&pdev->dev);
+	pm_runtime_dont_use_autosuspend(&pdev->dev);
+	pm_runtime_put_noidle(&pdev->dev);
+	pm_runtime_set_suspended(&pdev->dev);
+	regmap_update_bits(regs, DEFE_INT_EN_REG, DEFE_WB_INT_EN_MASK,
+	    DEFE_WB_INT_EN(DISABLE));
+	fe_coef_cache_free(&sunxi_fe_dev->coef_cache);
 err_disable_mod_clk:
 	clk_disable_unprepare(sunxi_fe_dev->mod_clk);
 err_disable_ram_clk:
@@ -1264,18 +4165,49 @@ err_assert_reset:
 
 static int sunxi_fe_remove(struct platform_device *pdev)
 {
+	struct sunxi_fe_device *sunxi_fe_dev = platform_get_drvdata(pdev);
+	unsigned int i;
 
 	PRINT_DE_FE("de_fe %s();\n", __FUNCTION__);
 
-	v4l2_m2m_release(sunxi_fe_dev->m2m_dev);
-	video_unregister_device(&sunxi_fe_dev->vfd);
-	v4l2_device_unregister(&sunxi_fe_dev->v4l2_dev);
+	mutex_lock(&sunxi_fe_cores_lock);
+	sunxi_fe_node_detach(sunxi_fe_dev);
+	sunxi_fe_cores[sunxi_fe_dev->id] = NULL;
+#ifdef CONFIG_PROC_FS
+	sunxi_fe_proc_put(sunxi_fe_dev);
+#endif /* CONFIG_PROC_FS */
+	mutex_unlock(&sunxi_fe_cores_lock);
+
+	/* Powered for the teardown, switched off for good below. */
+	pm_runtime_get_sync(&pdev->dev);
+
+	regmap_update_bits(sunxi_fe_dev->regs, DEFE_INT_EN_REG,
+	    DEFE_WB_INT_EN_MASK, DEFE_WB_INT_EN(DISABLE));
+	cancel_delayed_work_sync(&sunxi_fe_dev->watchdog_work);
+	fe_coef_cache_free(&sunxi_fe_dev->coef_cache);
+	for (i = 0; i < MAX_INPUT_BUFFERS; i++)
+		sunxi_fe_dmabuf_put(&sunxi_fe_dev->in_dmabuf[i]);
+
+	misc_deregister(&sunxi_fe_dev->misc);
+
+	pm_runtime_disable(&pdev->dev);
+	pm_runtime_dont_use_autosuspend(&pdev->dev);
+	pm_runtime_put_noidle(&pdev->dev);
+	if (!pm_runtime_status_suspended(&pdev->dev))
+		sunxi_fe_runtime_suspend(&pdev->dev);
+	pm_runtime_set_suspended(&pdev->dev);
 
-	misc_deregister(&fe_miscdevice);
 	dev_info(&pdev->dev, "Removed sunxi front end driver\n");
 	return 0;
 }
 
+static const struct dev_pm_ops sunxi_fe_pm_ops = {
+	SET_SYSTEM_SLEEP_PM_OPS(pm_runtime_force_suspend,
+	    pm_runtime_force_resume)
+	SET_RUNTIME_PM_OPS(sunxi_fe_runtime_suspend, sunxi_fe_runtime_resume,
+	    NULL)
+};
+
 #ifdef CONFIG_OF
 static const struct of_device_id sunxi_fe_of_table[] = {
 	{ .compatible = "allwinner,sun7i-a20-front-end" },
@@ -1291,6 +4223,7 @@ static struct platform_driver sunxi_fe_platform_driver = {
 		.name		= DRV_NAME,
 		.owner		= THIS_MODULE,
 		.of_match_table = of_match_ptr(sunxi_fe_of_table),
+		.pm		= &sunxi_fe_pm_ops,
 	},
 };
 
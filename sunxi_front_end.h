@@ -12,70 +12,118 @@
 #ifndef SUNXI_FRONT_END_H_
 #define SUNXI_FRONT_END_H_
 
+#include <linux/dma-fence.h>
+#include <linux/miscdevice.h>
 #include <linux/regmap.h>
+#include <linux/workqueue.h>
 #include "sunxi_front_end_dma_ctrl.h"
 #include "sunxi_front_end_color_space_converter.h"
+#include "sunxi_front_end_debe.h"
+#include "sunxi_front_end_reg_image.h"
+#include "sunxi_front_end_scaler_coef.h"
 #include <uapi/misc/sunxi_front_end.h>
 #include <media/v4l2-device.h>
 #include <media/v4l2-ctrls.h>
+#include <media/videobuf2-v4l2.h>
 
 #define DRV_NAME "sunxi-front-end"
 
-/* This will force the backend layer 2 to take the forntend as an input. */
-#define HACK_BACKEND_LAYER2_TO_FRONTEND
+/*
+ * A frame that has not been written back within this time is considered lost
+ * and its buffers are returned with an error.
+ */
+#define SUNXI_FE_JOB_TIMEOUT_MS		500
 
-#ifdef HACK_BACKEND_LAYER2_TO_FRONTEND
-#define SUN7I_DEBE_BASE			0x01e60000
-#define SUN7I_DEBE_SIZE			0x5800
+/*
+ * Staging a frame waits for the REG_RDY of the previous frame to be consumed,
+ * which happens at the start of that frame.
+ */
+#define SUNXI_FE_REG_RDY_POLL_US	10
+#define SUNXI_FE_REG_RDY_TIMEOUT_US	1000
 
-#define SUN7I_DEBE_MODCTL_REG		0x800
-#define ENABLE_LAY2			BIT(10)
+/* Driver specific controls. */
+#define SUNXI_FE_CID_BASE		(V4L2_CID_USER_BASE + 0x1000)
+#define SUNXI_FE_CID_BATCH_SIZE		(SUNXI_FE_CID_BASE + 0)
+#define SUNXI_FE_CID_DIRECT_OUTPUT	(SUNXI_FE_CID_BASE + 1)
+#define SUNXI_FE_CID_FANOUT_GROUP	(SUNXI_FE_CID_BASE + 2)
+
+#define SUNXI_FE_MAX_BATCH_SIZE		16
+/*
+ * A short batch is run once no buffer has been queued for this long, so the
+ * last frames of a stream do not wait for a batch that never fills up.
+ */
+#define SUNXI_FE_FLUSH_TIMEOUT_MS	100
+/* Fan-out groups and the capture-only contexts fed per source frame. */
+#define SUNXI_FE_MAX_FANOUT_GROUP	255
+#define SUNXI_FE_MAX_FANOUT		4
 
-//Datasheet states the laysize values adds 1. This seems to be incorrect.
-#define SUN7I_DEBE_LAYSIZE_REG_LAY2	0x818
-#define LAYSIZE_WIDTH(x)		((x))
-#define LAYSIZE_HEIGHT(x)		(((x)) << 16)
+/*
+ * Front-ends of the A20. Each has a misc device of its own, and a video device
+ * of its own unless the aggregate module parameter lets them share one.
+ */
+#define SUNXI_FE_MAX_CORES		2
 
-#define SUN7I_DEBE_LAYCOOR_LAY2		0x828
-#define LAY_COOR_X(x)			(x)
-#define LAY_COOR_Y(y)			(y<<16)
+/*
+ * An idle front-end is powered down after this delay, so a stream that is
+ * restarted right away does not wait for the resume.
+ */
+#define SUNXI_FE_AUTOSUSPEND_MS		1000
 
-#define SUN7I_DEBE_REGBUFFCTL		0x870
-#define DIS_AUTOLOAD_REG		BIT(1)
-#define REGLOADCTL			BIT(0)
+/*
+ * Range of the module clock. The scaler handles about a pixel per cycle, and
+ * the clock is set to the lowest rate that keeps up with the streaming
+ * contexts plus SUNXI_FE_RATE_HEADROOM percent for the memory latency.
+ */
+#define SUNXI_FE_MIN_MOD_RATE		24000000
+#define SUNXI_FE_MAX_MOD_RATE		300000000
+#define SUNXI_FE_RATE_HEADROOM		25
 
-#define LOAD_REG			(DIS_AUTOLOAD_REG | REGLOADCTL)
+/* A new configuration is latched within a frame, 40 ms at 25 fps. */
+#define SUNXI_FE_CONFIG_POLL_US		1000
+#define SUNXI_FE_CONFIG_TIMEOUT_US	40000
 
-#define SUN7I_DEBE_ATTCTL_REG0_LAY2	0x898
-#define LAY_GLBALPHA(x)			(x << 24)
-#define MAX_ALPHA			255
-#define MIN_ALPHA			0
-#define LAY_PRISEL(x)			(x << 10)
-#define DEF_VID_LAY_PRI			2 //Assuming layer 0/1 are at pri 0/1
-#define LAY_VDOEN(x)			(x << 1)
-#define EN_VID_CHAN			0x1
+/*
+ * sfe_input_dmabuf Input planes for the misc device, imported without a copy.
+ * Not part of the uapi header yet, it uses the ioctl type of
+ * SFE_IOCTL_SET_INPUT.
+ * fd: dma-buf of each plane, -1 for planes the input format does not use.
+ * offset: Byte offset of the plane within its dma-buf.
+ */
+struct sfe_input_dmabuf {
+	__s32					fd[MAX_INPUT_BUFFERS];
+	__u32					offset[MAX_INPUT_BUFFERS];
+};
 
-#define SUN7I_DEBE_ATTCTL_REG1_LAY2	0x8a8
-#define LAY_FMT(x)			(x << 8)
-#define LAY_FMT_ARGB_8888 		0xa //color 32-bpp (Alpha:8/R:8/G:8/B:8)
+#define SFE_IOCTL_SET_INPUT_DMABUF	_IOW(_IOC_TYPE(SFE_IOCTL_SET_INPUT), \
+    0x20, struct sfe_input_dmabuf)
 
-#define SUN7I_DEBE_LAY2			0x8a8
-#endif /* HACK_BACKEND_LAYER2_TO_FRONTEND */
+/* This will force the backend layer 2 to take the forntend as an input. */
+#define HACK_BACKEND_LAYER2_TO_FRONTEND
 
 #define PRINT_DE_FE(fmt, args...)	((sunxi_de_fe_debug_lvl) == 0 ? 0 : \
     (printk( fmt, ## args)))
 
 extern uint32_t sunxi_de_fe_debug_lvl;
 
+/*
+ * sunxi_de_fe_fmt A V4L2 pixel format.
+ * drm_fourcc: Its descriptor, see sunxi_front_end_format.c.
+ * num_planes: Buffer planes, a single buffer plane may hold all color planes.
+ */
 struct sunxi_de_fe_fmt {
 	u32					fourcc;
-	int					depth;
-	u32					types;
+	u32					drm_fourcc;
 	unsigned int 	num_planes;
 };
 
 struct sunxi_de_fe_ctx {
 	struct v4l2_fh				fh;
+	struct sunxi_fe_node			*node;
+	/*
+	 * Front-end that was handed the last frame of the context. It only
+	 * changes while no frames of the context are in flight. Protected by
+	 * job_lock.
+	 */
 	struct sunxi_fe_device			*dev;
 
 	/* Todo: thomas remove obsolete structs, such as destination fmt */
@@ -86,12 +134,207 @@ struct sunxi_de_fe_ctx {
 
 	struct v4l2_ctrl_handler 		hdl;
 
+	/*
+	 * Conversion of this context and the registers that implement it,
+	 * one image for each stripe of the geometry.
+	 */
+	struct sunxi_fe_config			cfg;
+	struct fe_geometry			geo;
+	struct fe_reg_image			regs[FE_GEO_MAX_STRIPES];
+
+	/*
+	 * Conversion set while a frame was halfway its stripes or fan-out
+	 * targets. It replaces cfg, geo and regs when the next frame starts.
+	 * Protected by job_lock.
+	 */
+	bool					pending;
+	struct sunxi_fe_config			pending_cfg;
+	struct fe_geometry			pending_geo;
+	struct fe_reg_image		pending_regs[FE_GEO_MAX_STRIPES];
+
+	/*
+	 * Number of frames processed per m2m job. flush lets the next job
+	 * run with fewer frames, it is set by V4L2_DEC_CMD_STOP or by
+	 * flush_work once the queues stay idle.
+	 */
+	unsigned int				batch_size;
+	bool					flush;
+	struct delayed_work			flush_work;
+
+	/*
+	 * Set by V4L2_DEC_CMD_STOP until an empty capture buffer is returned
+	 * with V4L2_BUF_FLAG_LAST. Protected by job_lock.
+	 */
+	bool					draining;
+
+	/*
+	 * Frame interval set through S_PARM, 0/0 to convert as fast as
+	 * possible. Queues of the context that stream and the entry in the
+	 * stream_list of the node. All protected by job_lock.
+	 */
+	struct v4l2_fract			timeperframe;
+	unsigned int				nr_streaming;
+	struct list_head			stream_entry;
+
+	/*
+	 * Frames go straight to the back-end instead of being written back,
+	 * fixed while streaming.
+	 */
+	bool					direct;
+	struct v4l2_ctrl			*direct_ctrl;
+
+	/*
+	 * Field of the source buffer at the head of the queue that is staged
+	 * next, 0 for progressive input. Protected by job_lock.
+	 */
+	unsigned int				field;
+
+	/*
+	 * Stripe of the frame that is staged next, and whether a stripe of
+	 * the frame failed. The latter is only touched by frame completion.
+	 */
+	unsigned int				stripe;
+	bool					stripe_error;
+
+	/*
+	 * Fan-out group of the context, 0 for none, and its entry in the
+	 * fanout_list of the device. A context of a group that has no OUTPUT
+	 * format is a target: its capture buffers are filled from the source
+	 * frames of the group's other contexts, and fanout_dirty asks for its
+	 * registers to be rebuilt. A source scales the current field for the
+	 * targets in fanout first, target is the one staged next, and its own
+	 * output comes last. All protected by job_lock.
+	 */
+	unsigned int				fanout_group;
+	struct v4l2_ctrl			*fanout_ctrl;
+	struct list_head			fanout_entry;
+	bool					fanout_dirty;
+	struct sunxi_de_fe_ctx			*fanout[SUNXI_FE_MAX_FANOUT];
+	unsigned int				nr_fanout;
+	unsigned int				target;
+
+	/*
+	 * Source buffers waiting for their fences, in queueing order.
+	 * Protected by fence_lock.
+	 */
+	spinlock_t				fence_lock;
+	struct list_head			fence_list;
+
+	/*
+	 * Timeline of the out-fences of the destination buffers, in the
+	 * order they are queued. Protected by the fence_lock of the node.
+	 */
+	u64					out_fence_context;
+	unsigned int				out_fence_seqno;
+
 	struct vb2_buffer 			*dst_bufs[VIDEO_MAX_FRAME];
 
 	struct v4l2_ctrl 			*mpeg2_frame_hdr_ctrl;
 	struct v4l2_ctrl 			*mpeg4_frame_hdr_ctrl;
 };
 
+/*
+ * sunxi_fe_buffer A vb2 buffer of the front-end.
+ * in_fence: Fence a source buffer waits on before it is handed to the m2m
+ *  core, NULL once it may be processed.
+ * in_fence_cb, in_fence_work: Hand the buffer over once the fence signals.
+ * in_fence_entry: Entry in the fence_list of the context.
+ * out_fence: Fence of a destination buffer, signalled when it has been
+ *  written back. Created at QBUF and attached to its dma-bufs as exclusive
+ *  fence.
+ */
+struct sunxi_fe_buffer {
+	struct v4l2_m2m_buffer			m2m_buf;
+	struct dma_fence			*in_fence;
+	struct dma_fence_cb			in_fence_cb;
+	struct work_struct			in_fence_work;
+	struct list_head			in_fence_entry;
+	struct dma_fence			*out_fence;
+};
+
+/*
+ * sunxi_fe_frame A frame handed to the hardware.
+ * ctx: context the frame belongs to, NULL when the slot is empty.
+ * src_ctx: context of src, differs from ctx for a fan-out target.
+ * src, dst: buffers, already removed from the m2m queues.
+ * finish_job: the m2m job of this frame is still running and is finished
+ *  when the frame is started.
+ * direct: the frame is sent to the back-end instead of written back. Such a
+ *  frame is shown until the next frame is latched, which the register load
+ *  interrupt reports.
+ * field: field of an interlaced source that is scaled, 0 for the top one.
+ * stripe: stripe of the geometry that is scaled.
+ * keep_src, keep_dst: the buffer is still on its m2m queue, because its
+ *  other stripes or the bottom field follow.
+ */
+struct sunxi_fe_frame {
+	struct sunxi_de_fe_ctx			*ctx;
+	struct sunxi_de_fe_ctx			*src_ctx;
+	struct vb2_v4l2_buffer			*src, *dst;
+	bool					finish_job;
+	bool					direct;
+	unsigned int				field;
+	unsigned int				stripe;
+	bool					keep_src, keep_dst;
+};
+
+/*
+ * sunxi_fe_dmabuf A dma-buf mapped for the front-end, all NULL when unused.
+ */
+struct sunxi_fe_dmabuf {
+	struct dma_buf				*buf;
+	struct dma_buf_attachment		*attach;
+	struct sg_table				*sgt;
+};
+
+/*
+ * sunxi_fe_node The video device of one or more front-ends.
+ * dev: Device that buffers are allocated for, that of the first front-end.
+ * frame_wq: Woken whenever a front-end is done with a frame.
+ * cores: Front-ends that run the jobs, ordered by instance.
+ */
+struct sunxi_fe_node {
+	struct device				*dev;
+	struct v4l2_device			v4l2_dev;
+	struct v4l2_m2m_dev			*m2m_dev;
+	struct video_device			vfd;
+	wait_queue_head_t			frame_wq;
+
+	/* Lock of the out-fences of destination buffers. */
+	spinlock_t				fence_lock;
+
+	/*
+	 * Context of the m2m job that still has frames to stage and the
+	 * number of those frames. Protected by job_lock, which also
+	 * serializes the register access of the front-ends.
+	 */
+	struct mutex				job_lock;
+	struct sunxi_de_fe_ctx			*job_ctx;
+	unsigned int				job_left;
+
+	/* Contexts that are in a fan-out group, protected by job_lock. */
+	struct list_head			fanout_list;
+
+	/*
+	 * Contexts with a streaming queue, whose pixel rates set the module
+	 * clock of the front-ends. Protected by job_lock.
+	 */
+	struct list_head			stream_list;
+
+	/*
+	 * Streaming queues, which keep all front-ends of the node resumed.
+	 * Protected by job_lock, like the front-ends.
+	 */
+	unsigned int				pm_users;
+	struct sunxi_fe_device			*cores[SUNXI_FE_MAX_CORES];
+	unsigned int				nr_cores;
+};
+
+/*
+ * sunxi_fe_device A front-end.
+ * id: Instance, 0 for DEFE0.
+ * node: Video device whose jobs the front-end runs.
+ */
 struct sunxi_fe_device {
 	const char				*phys_name;
 	struct device				*dev;
@@ -99,25 +342,53 @@ struct sunxi_fe_device {
 	struct clk				*ahb_clk;
 	struct clk				*ram_clk;
 	struct clk				*mod_clk;
+	/* Rate mod_clk was last set to, protected by job_lock. */
+	unsigned long				mod_rate;
 	struct reset_control			*reset;
+	int					irq;
 
-	struct v4l2_device			v4l2_dev;
-	struct v4l2_m2m_dev			*m2m_dev;
-	struct video_device			vfd;
+	unsigned int				id;
+	struct sunxi_fe_node			*node;
+	/* Set while leaving the node, protected by job_lock. */
+	bool					detaching;
+	struct miscdevice			misc;
+	char					misc_name[32];
 
 	// /* Mutex for device file */
 	// struct mutex				dev_mutex;
-	// /* Spinlock for interrupt */
-	// spinlock_t				irqlock;
+	/* Spinlock for interrupt */
+	spinlock_t				irqlock;
+	/* Returns the running job if the write-back irq never arrives. */
+	struct delayed_work			watchdog_work;
 
-	struct dma_control			dma_ctrl;
+	/*
+	 * Frame being processed, frame waiting in the shadow registers and
+	 * frame waiting for the irq thread. Protected by irqlock.
+	 */
+	struct sunxi_fe_frame			active;
+	struct sunxi_fe_frame			staged;
+	struct sunxi_fe_frame			done;
 
 	struct sfe_input_buffers		in_bufs;
-	uint32_t				in_width, in_height;
-	uint32_t				out_width, out_height;
-	uint32_t				input_fmt, output_fmt;
+	/* Conversion configured through the misc device. */
+	struct sunxi_fe_config			cfg;
+	struct fe_geometry			misc_geo;
+	struct fe_reg_image			misc_regs;
+	/* Register values the hardware holds, protected by job_lock. */
+	struct fe_reg_image			hw_regs;
+	/*
+	 * Generated scaler filters and the filters loaded per channel and
+	 * direction. Protected by job_lock.
+	 */
+	struct fe_coef_cache			coef_cache;
+	uint32_t			coef_keys[DEFE_NR_COEF_CHANNELS][2];
 
+	/* Input planes imported through SFE_IOCTL_SET_INPUT_DMABUF. */
+	struct sunxi_fe_dmabuf			in_dmabuf[MAX_INPUT_BUFFERS];
 	dma_addr_t				dma_in_addr[MAX_INPUT_BUFFERS];
+
+	/* DEBE layer scanning out the front-end. */
+	struct sunxi_fe_plane			plane;
 };
 
 int fe_start_conversion(void);
@@ -14,6 +14,7 @@
 #include "sunxi_front_end.h"
 #include "sunxi_front_end_registers.h"
 #include "sunxi_front_end_color_space_converter.h"
+#include "sunxi_front_end_reg_image.h"
 
 /*
  * See https://en.wikipedia.org/wiki/YCbCr#ITU-R_BT.601_conversion
@@ -58,13 +59,20 @@ static const uint32_t coef_to_reg[NR_CSC_COLORS][NR_CSC_COLOR_COEF] = {
 	},
 };
 
-int setup_csc(struct sunxi_fe_device *sunxi_fe_dev)
+/*
+ * setup_csc() - sets up the color space converter and the output format
+ *
+ * YUV input is converted to RGB output. RGB input, and YUV input that is
+ * written back as YUV, bypass the converter.
+ */
+int setup_csc(struct sunxi_fe_config *cfg, const struct fe_geometry *geo,
+    struct fe_reg_image *img)
 {
 	int ret;
 	uint8_t i, j;
 	uint16_t val;
 
-	// switch (sunxi_fe_dev->input_fmt) {
+	// switch (cfg->input_fmt) {
 	// case DRM_FORMAT_YUV420:
 	for (i = 0; i < NR_CSC_COLORS; i++) {
 		for (j = 0; j < NR_CSC_COLOR_COEF; j++) {
@@ -75,9 +83,8 @@ int setup_csc(struct sunxi_fe_device *sunxi_fe_dev)
 
 			PRINT_DE_FE("set coef @ offset 0x%x to 0x%x \n",
 			    coef_to_reg[i][j], val);
-			ret = regmap_write(sunxi_fe_dev->regs,
-			    coef_to_reg[i][j], val);
-			if (ret == -EIO) {
+			ret = fe_reg_image_write(img, coef_to_reg[i][j], val);
+			if (ret < 0) {
 				printk("Could not set csc matrix[%d][%d].\n",
 				    i, j);
 				return -1;
@@ -85,36 +92,20 @@ int setup_csc(struct sunxi_fe_device *sunxi_fe_dev)
 		}
 	};
 
-	ret = regmap_write(sunxi_fe_dev->regs, DEFE_INPUT_FMT_REG,
-	    DEFE_INPUT_DATA_MOD(DEFE_MOD_TILE_BASED_UV_COMBINED) |
-	    DEFE_INPUT_DATA_FMT(DEFE_INP_FMT_YUV420) |
-	    DEFE_INPUT_PS(DEFE_INP_PS_U1V1U0V0) );
-	if (ret == -EIO) {
-		printk("Could not set input format.\n");
-		return -1;
-	}
 	// default:
 	// 	printk("Unsupported input format for csc.\n");
 	// 	return -1;
 	// }
 
-	// switch (sunxi_fe_dev->output_fmt) {
-	// case DRM_FORMAT_XRGB8888:
-	ret = regmap_write(sunxi_fe_dev->regs, DEFE_OUTPUT_FMT_REG,
-	    DEFE_OUTPUT_DATA_FMT(DEFE_OUT_FMT_INTERL_ARGB8888));
-	if (ret == -EIO) {
+	ret = fe_reg_image_write(img, DEFE_OUTPUT_FMT_REG, geo->output_fmt);
+	if (ret < 0) {
 		printk("Could not set output format.\n");
 		return -1;
 	}
-	// break;
-	// default:
-	// 	printk("Unsupported output format for csc.\n");
-	// 	return -1;
-	// }
 
-	ret = regmap_write(sunxi_fe_dev->regs, DEFE_BYPASS_REG,
-	    DEFE_CSC_BYPASS_EN(DISABLE));
-	if (ret == -EIO) {
+	ret = fe_reg_image_write(img, DEFE_BYPASS_REG,
+	    DEFE_CSC_BYPASS_EN(geo->csc ? DISABLE : ENABLE));
+	if (ret < 0) {
 		printk("Could not enable csc.\n");
 		return -1;
 	}
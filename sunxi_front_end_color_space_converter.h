@@ -19,9 +19,12 @@
 #define CSC_COLOR_CONST_COEF_POS	3
 #define COEF_OFFSET			4
 
-struct sunxi_fe_device;
+struct sunxi_fe_config;
+struct fe_geometry;
+struct fe_reg_image;
 
-int setup_csc(struct sunxi_fe_device *sunxi_fe_dev);
+int setup_csc(struct sunxi_fe_config *cfg, const struct fe_geometry *geo,
+    struct fe_reg_image *img);
 
 #endif /* SUNXI_FRONT_END_COLOR_SPACE_CONVERTER_H_ */
 
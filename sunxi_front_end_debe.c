@@ -0,0 +1,141 @@
+/*
+ * Copyright (C) 2017 Vitsch Electronics
+ *
+ * Thomas van Kleef <linux-dev@vitsch.nl>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of
+ * the License, or (at your option) any later version.
+ */
+
+/*
+ * The front-end feeds DEBE layer 2 through its video channel, so the layer
+ * acts as an overlay plane that is scaled by the front-end. The DEBE is owned
+ * by the display driver; only the registers of layer 2 and the register
+ * buffer control are touched here.
+ *
+ * Updates are flipped at vblank: the layer registers are buffered and only
+ * loaded by the DEBE at the next vblank after REGLOADCTL has been set. The
+ * next update waits for that load, so a half written set of registers is
+ * never latched.
+ */
+#include <linux/device.h>
+#include <linux/io.h>
+#include <linux/iopoll.h>
+#include "sunxi_front_end.h"
+#include "sunxi_front_end_debe.h"
+
+int sunxi_fe_plane_init(struct device *dev, struct sunxi_fe_plane *plane)
+{
+
+	mutex_init(&plane->lock);
+	plane->enabled = false;
+
+	/* Shared with the display driver, so the region is not requested. */
+	plane->regs = devm_ioremap(dev, SUN7I_DEBE_BASE, SUN7I_DEBE_SIZE);
+	if (!plane->regs)
+		return -ENOMEM;
+
+	return 0;
+}
+
+/*
+ * sunxi_fe_plane_wait_load() - waits for the previous flip to be latched
+ *
+ * Without a running display the load never happens. Its values are then
+ * simply loaded together with the new ones.
+ */
+static void sunxi_fe_plane_wait_load(struct sunxi_fe_plane *plane)
+{
+	uint32_t val;
+
+	if (readl_poll_timeout(plane->regs + SUN7I_DEBE_REGBUFFCTL, val,
+	    !(val & REGLOADCTL), SUN7I_DEBE_LOAD_POLL_US,
+	    SUN7I_DEBE_LOAD_TIMEOUT_US))
+		PRINT_DE_FE("de_fe previous DEBE flip was not latched\n");
+}
+
+static void sunxi_fe_plane_flip(struct sunxi_fe_plane *plane)
+{
+
+	writel(LOAD_REG, plane->regs + SUN7I_DEBE_REGBUFFCTL);
+}
+
+/*
+ * sunxi_fe_plane_update() - shows the front-end output at x, y
+ *
+ * Nothing is written if the layer already shows it there.
+ */
+int sunxi_fe_plane_update(struct sunxi_fe_plane *plane, uint32_t x,
+    uint32_t y, uint32_t width, uint32_t height)
+{
+	uint32_t val;
+
+	if (!plane->regs)
+		return -ENODEV;
+
+	mutex_lock(&plane->lock);
+	if (plane->enabled && plane->x == x && plane->y == y &&
+	    plane->width == width && plane->height == height) {
+		mutex_unlock(&plane->lock);
+		return 0;
+	}
+
+	sunxi_fe_plane_wait_load(plane);
+
+	writel(LAYSIZE_HEIGHT(height) | LAYSIZE_WIDTH(width),
+	    plane->regs + SUN7I_DEBE_LAYSIZE_REG_LAY2);
+	writel(LAY_COOR_Y(y) | LAY_COOR_X(x),
+	    plane->regs + SUN7I_DEBE_LAYCOOR_LAY2);
+
+	if (!plane->enabled) {
+		writel(LAY_GLBALPHA(MAX_ALPHA) | LAY_PRISEL(DEF_VID_LAY_PRI) |
+		    LAY_VDOEN(EN_VID_CHAN),
+		    plane->regs + SUN7I_DEBE_ATTCTL_REG0_LAY2);
+		writel(LAY_FMT(LAY_FMT_ARGB_8888),
+		    plane->regs + SUN7I_DEBE_ATTCTL_REG1_LAY2);
+
+		val = readl(plane->regs + SUN7I_DEBE_MODCTL_REG);
+		writel(val | ENABLE_LAY2, plane->regs + SUN7I_DEBE_MODCTL_REG);
+	}
+
+	sunxi_fe_plane_flip(plane);
+
+	plane->enabled = true;
+	plane->x = x;
+	plane->y = y;
+	plane->width = width;
+	plane->height = height;
+	mutex_unlock(&plane->lock);
+
+	return 0;
+}
+
+int sunxi_fe_plane_disable(struct sunxi_fe_plane *plane)
+{
+	uint32_t val;
+
+	if (!plane->regs)
+		return -ENODEV;
+
+	mutex_lock(&plane->lock);
+	if (!plane->enabled) {
+		mutex_unlock(&plane->lock);
+		return 0;
+	}
+
+	sunxi_fe_plane_wait_load(plane);
+
+	//It is enough just to disable layer2
+	val = readl(plane->regs + SUN7I_DEBE_MODCTL_REG);
+	writel(val & ~ENABLE_LAY2, plane->regs + SUN7I_DEBE_MODCTL_REG);
+	writel(0x0, plane->regs + SUN7I_DEBE_ATTCTL_REG0_LAY2);
+
+	sunxi_fe_plane_flip(plane);
+
+	plane->enabled = false;
+	mutex_unlock(&plane->lock);
+
+	return 0;
+}
@@ -0,0 +1,84 @@
+/*
+ * Copyright (C) 2017 Vitsch Electronics
+ *
+ * Thomas van Kleef <linux-dev@vitsch.nl>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of
+ * the License, or (at your option) any later version.
+ */
+
+#ifndef SUNXI_FRONT_END_DEBE_H_
+#define SUNXI_FRONT_END_DEBE_H_
+
+#include <linux/mutex.h>
+#include <linux/types.h>
+
+#define SUN7I_DEBE_BASE			0x01e60000
+#define SUN7I_DEBE_SIZE			0x5800
+
+#define SUN7I_DEBE_MODCTL_REG		0x800
+#define ENABLE_LAY2			BIT(10)
+
+//Datasheet states the laysize values adds 1. This seems to be incorrect.
+#define SUN7I_DEBE_LAYSIZE_REG_LAY2	0x818
+#define LAYSIZE_WIDTH(x)		((x))
+#define LAYSIZE_HEIGHT(x)		(((x)) << 16)
+
+#define SUN7I_DEBE_LAYCOOR_LAY2		0x828
+#define LAY_COOR_X(x)			(x)
+#define LAY_COOR_Y(y)			(y<<16)
+
+#define SUN7I_DEBE_REGBUFFCTL		0x870
+#define DIS_AUTOLOAD_REG		BIT(1)
+#define REGLOADCTL			BIT(0)
+
+#define LOAD_REG			(DIS_AUTOLOAD_REG | REGLOADCTL)
+
+#define SUN7I_DEBE_ATTCTL_REG0_LAY2	0x898
+#define LAY_GLBALPHA(x)			(x << 24)
+#define MAX_ALPHA			255
+#define MIN_ALPHA			0
+#define LAY_PRISEL(x)			(x << 10)
+#define DEF_VID_LAY_PRI			2 //Assuming layer 0/1 are at pri 0/1
+#define LAY_VDOEN(x)			(x << 1)
+#define EN_VID_CHAN			0x1
+
+#define SUN7I_DEBE_ATTCTL_REG1_LAY2	0x8a8
+#define LAY_FMT(x)			(x << 8)
+#define LAY_FMT_ARGB_8888 		0xa //color 32-bpp (Alpha:8/R:8/G:8/B:8)
+
+#define SUN7I_DEBE_LAY2			0x8a8
+
+/*
+ * The buffered DEBE registers are loaded at the next vblank once REGLOADCTL
+ * has been set, which clears the bit again. Waiting for a previous load is
+ * bounded by a frame at 20 Hz.
+ */
+#define SUN7I_DEBE_LOAD_POLL_US		500
+#define SUN7I_DEBE_LOAD_TIMEOUT_US	50000
+
+struct device;
+
+/*
+ * sunxi_fe_plane DEBE layer 2, scanning out the output of the front-end.
+ * regs: DEBE registers, mapped for the lifetime of the device.
+ * lock: Serialises updates of the layer.
+ * enabled, width, height, x, y: What the layer was last programmed with, so
+ *  that only changes are written.
+ */
+struct sunxi_fe_plane {
+	void __iomem			*regs;
+	struct mutex			lock;
+	bool				enabled;
+	uint32_t			width, height;
+	uint32_t			x, y;
+};
+
+int sunxi_fe_plane_init(struct device *dev, struct sunxi_fe_plane *plane);
+int sunxi_fe_plane_update(struct sunxi_fe_plane *plane, uint32_t x,
+    uint32_t y, uint32_t width, uint32_t height);
+int sunxi_fe_plane_disable(struct sunxi_fe_plane *plane);
+
+#endif /* SUNXI_FRONT_END_DEBE_H_ */
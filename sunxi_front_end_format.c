@@ -0,0 +1,185 @@
+/*
+ * Copyright (C) 2017 Vitsch Electronics
+ *
+ * Thomas van Kleef <linux-dev@vitsch.nl>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of
+ * the License, or (at your option) any later version.
+ */
+
+/*
+ * Every format the front-end reads or writes is described by a single entry
+ * below. The geometry planner and the V4L2 formats are derived from it, so a
+ * new format only needs an entry here and its V4L2 fourcc.
+ */
+#include <linux/kernel.h>
+#include "sunxi_front_end_format.h"
+#include "sunxi_front_end_registers.h"
+
+#define FE_PLANE(cpp, channel, dma)	{ cpp, channel, dma }
+#define FE_PLANES_Y_UV			{ FE_PLANE(1, 0, IDMA0), \
+    FE_PLANE(2, 1, IDMA1) }
+#define FE_PLANES_Y_U_V			{ FE_PLANE(1, 0, IDMA0), \
+    FE_PLANE(1, 1, IDMA1), FE_PLANE(1, 1, IDMA2) }
+#define FE_PLANES_Y_V_U			{ FE_PLANE(1, 0, IDMA0), \
+    FE_PLANE(1, 1, IDMA2), FE_PLANE(1, 1, IDMA1) }
+#define FE_PLANES_PACKED(cpp)		{ FE_PLANE(cpp, 0, IDMA0) }
+
+static const struct fe_format fe_formats[] = {
+	{
+		.fourcc = FE_FORMAT_MB32_NV12,
+		.dirs = FE_FORMAT_IN,
+		.nr_planes = 2, .tiled = true, .yuv = true,
+		.hsub = 2, .vsub = 2,
+		.in_mode = DEFE_MOD_TILE_BASED_UV_COMBINED,
+		.in_fmt = DEFE_INP_FMT_YUV420, .in_ps = DEFE_INP_PS_U1V1U0V0,
+		.plane = FE_PLANES_Y_UV,
+	},
+	{
+		.fourcc = DRM_FORMAT_NV12,
+		.dirs = FE_FORMAT_IN,
+		.nr_planes = 2, .yuv = true, .hsub = 2, .vsub = 2,
+		.in_mode = DEFE_MOD_NON_TILE_BASED_UV_COMBINED,
+		.in_fmt = DEFE_INP_FMT_YUV420, .in_ps = DEFE_INP_PS_U1V1U0V0,
+		.plane = FE_PLANES_Y_UV,
+	},
+	{
+		.fourcc = DRM_FORMAT_NV21,
+		.dirs = FE_FORMAT_IN,
+		.nr_planes = 2, .yuv = true, .hsub = 2, .vsub = 2,
+		.in_mode = DEFE_MOD_NON_TILE_BASED_UV_COMBINED,
+		.in_fmt = DEFE_INP_FMT_YUV420, .in_ps = DEFE_INP_PS_V1U1V0U0,
+		.plane = FE_PLANES_Y_UV,
+	},
+	{
+		.fourcc = DRM_FORMAT_NV16,
+		.dirs = FE_FORMAT_IN,
+		.nr_planes = 2, .yuv = true, .hsub = 2, .vsub = 1,
+		.in_mode = DEFE_MOD_NON_TILE_BASED_UV_COMBINED,
+		.in_fmt = DEFE_INP_FMT_YUV422, .in_ps = DEFE_INP_PS_U1V1U0V0,
+		.plane = FE_PLANES_Y_UV,
+	},
+	{
+		.fourcc = DRM_FORMAT_NV61,
+		.dirs = FE_FORMAT_IN,
+		.nr_planes = 2, .yuv = true, .hsub = 2, .vsub = 1,
+		.in_mode = DEFE_MOD_NON_TILE_BASED_UV_COMBINED,
+		.in_fmt = DEFE_INP_FMT_YUV422, .in_ps = DEFE_INP_PS_V1U1V0U0,
+		.plane = FE_PLANES_Y_UV,
+	},
+	{
+		.fourcc = DRM_FORMAT_YUV420,
+		.dirs = FE_FORMAT_IN | FE_FORMAT_OUT,
+		.nr_planes = 3, .yuv = true, .hsub = 2, .vsub = 2,
+		.in_mode = DEFE_MOD_NON_TILE_BASED_PLANAR,
+		.in_fmt = DEFE_INP_FMT_YUV420,
+		.out_fmt = DEFE_OUT_FMT_PLANAR_YUV420,
+		.plane = FE_PLANES_Y_U_V,
+	},
+	{
+		.fourcc = DRM_FORMAT_YVU420,
+		.dirs = FE_FORMAT_IN | FE_FORMAT_OUT,
+		.nr_planes = 3, .yuv = true, .hsub = 2, .vsub = 2,
+		.in_mode = DEFE_MOD_NON_TILE_BASED_PLANAR,
+		.in_fmt = DEFE_INP_FMT_YUV420,
+		.out_fmt = DEFE_OUT_FMT_PLANAR_YUV420,
+		.plane = FE_PLANES_Y_V_U,
+	},
+	{
+		.fourcc = DRM_FORMAT_YUV422,
+		.dirs = FE_FORMAT_IN | FE_FORMAT_OUT,
+		.nr_planes = 3, .yuv = true, .hsub = 2, .vsub = 1,
+		.in_mode = DEFE_MOD_NON_TILE_BASED_PLANAR,
+		.in_fmt = DEFE_INP_FMT_YUV422,
+		.out_fmt = DEFE_OUT_FMT_PLANAR_YUV422,
+		.plane = FE_PLANES_Y_U_V,
+	},
+	{
+		.fourcc = DRM_FORMAT_YUV411,
+		.dirs = FE_FORMAT_IN | FE_FORMAT_OUT,
+		.nr_planes = 3, .yuv = true, .hsub = 4, .vsub = 1,
+		.in_mode = DEFE_MOD_NON_TILE_BASED_PLANAR,
+		.in_fmt = DEFE_INP_FMT_YUV411,
+		.out_fmt = DEFE_OUT_FMT_PLANAR_YUV411,
+		.plane = FE_PLANES_Y_U_V,
+	},
+	{
+		.fourcc = DRM_FORMAT_YUV444,
+		.dirs = FE_FORMAT_IN | FE_FORMAT_OUT,
+		.nr_planes = 3, .yuv = true, .hsub = 1, .vsub = 1,
+		.in_mode = DEFE_MOD_NON_TILE_BASED_PLANAR,
+		.in_fmt = DEFE_INP_FMT_YUV444,
+		.out_fmt = DEFE_OUT_FMT_PLANAR_YUV444,
+		.plane = FE_PLANES_Y_U_V,
+	},
+	{
+		.fourcc = DRM_FORMAT_YUYV,
+		.dirs = FE_FORMAT_IN,
+		.nr_planes = 1, .yuv = true, .hsub = 2, .vsub = 1,
+		.in_mode = DEFE_MOD_NON_TILE_BASED_INTERLEAVED,
+		.in_fmt = DEFE_INP_FMT_YUV422, .in_ps = DEFE_INP_PS_YUYV,
+		.plane = FE_PLANES_PACKED(2),
+	},
+	{
+		.fourcc = DRM_FORMAT_UYVY,
+		.dirs = FE_FORMAT_IN,
+		.nr_planes = 1, .yuv = true, .hsub = 2, .vsub = 1,
+		.in_mode = DEFE_MOD_NON_TILE_BASED_INTERLEAVED,
+		.in_fmt = DEFE_INP_FMT_YUV422, .in_ps = DEFE_INP_PS_UYVY,
+		.plane = FE_PLANES_PACKED(2),
+	},
+	{
+		.fourcc = DRM_FORMAT_YVYU,
+		.dirs = FE_FORMAT_IN,
+		.nr_planes = 1, .yuv = true, .hsub = 2, .vsub = 1,
+		.in_mode = DEFE_MOD_NON_TILE_BASED_INTERLEAVED,
+		.in_fmt = DEFE_INP_FMT_YUV422, .in_ps = DEFE_INP_PS_YVYU,
+		.plane = FE_PLANES_PACKED(2),
+	},
+	{
+		.fourcc = DRM_FORMAT_VYUY,
+		.dirs = FE_FORMAT_IN,
+		.nr_planes = 1, .yuv = true, .hsub = 2, .vsub = 1,
+		.in_mode = DEFE_MOD_NON_TILE_BASED_INTERLEAVED,
+		.in_fmt = DEFE_INP_FMT_YUV422, .in_ps = DEFE_INP_PS_VYUY,
+		.plane = FE_PLANES_PACKED(2),
+	},
+	{
+		.fourcc = DRM_FORMAT_XRGB8888,
+		.dirs = FE_FORMAT_IN | FE_FORMAT_OUT,
+		.nr_planes = 1, .hsub = 1, .vsub = 1,
+		.in_mode = DEFE_MOD_NON_TILE_BASED_INTERLEAVED,
+		.in_fmt = DEFE_INP_FMT_RGB888, .in_ps = DEFE_INP_PS_ARGB,
+		.out_fmt = DEFE_OUT_FMT_INTERL_ARGB8888,
+		.plane = FE_PLANES_PACKED(4),
+	},
+	{
+		.fourcc = DRM_FORMAT_BGRX8888,
+		.dirs = FE_FORMAT_IN | FE_FORMAT_OUT,
+		.nr_planes = 1, .hsub = 1, .vsub = 1,
+		.in_mode = DEFE_MOD_NON_TILE_BASED_INTERLEAVED,
+		.in_fmt = DEFE_INP_FMT_RGB888, .in_ps = DEFE_INP_PS_BGRA,
+		.out_fmt = DEFE_OUT_FMT_INTERL_BGRA8888,
+		.plane = FE_PLANES_PACKED(4),
+	},
+};
+
+/*
+ * fe_format_find() - looks up the descriptor of a format
+ *
+ * dirs holds the FE_FORMAT_IN and FE_FORMAT_OUT uses that are required,
+ * 0 for any.
+ */
+const struct fe_format *fe_format_find(uint32_t fourcc, uint8_t dirs)
+{
+	unsigned int i;
+
+	for (i = 0; i < ARRAY_SIZE(fe_formats); i++)
+		if (fe_formats[i].fourcc == fourcc &&
+		    (fe_formats[i].dirs & dirs) == dirs)
+			return &fe_formats[i];
+
+	return NULL;
+}
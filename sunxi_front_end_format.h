@@ -0,0 +1,67 @@
+/*
+ * Copyright (C) 2017 Vitsch Electronics
+ *
+ * Thomas van Kleef <linux-dev@vitsch.nl>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of
+ * the License, or (at your option) any later version.
+ */
+
+#ifndef SUNXI_FRONT_END_FORMAT_H_
+#define SUNXI_FRONT_END_FORMAT_H_
+
+#include <linux/bitops.h>
+#include <linux/types.h>
+#include <uapi/drm/drm_fourcc.h>
+
+#define FE_FORMAT_MAX_PLANES			3
+
+#define FE_FORMAT_IN				BIT(0)
+#define FE_FORMAT_OUT				BIT(1)
+
+/*
+ * The MB32 tiled output of the VPU: a Y plane and a UV combined plane, both
+ * in tiles of 32x32 bytes. DRM has no fourcc for it.
+ */
+#define FE_FORMAT_MB32_NV12			fourcc_code('M', 'B', '1', '2')
+
+/*
+ * fe_format_plane Memory layout of a plane.
+ * cpp: Bytes per sample.
+ * channel: Scaler channel that processes the plane. The planes of channel 1
+ *  hold the subsampled chroma.
+ * dma: Input dma channel that reads the plane, or for output the write-back
+ *  channel that writes it.
+ */
+struct fe_format_plane {
+	uint8_t				cpp;
+	uint8_t				channel;
+	uint8_t				dma;
+};
+
+/*
+ * fe_format Descriptor of a format.
+ * fourcc: DRM fourcc of the format.
+ * dirs: FE_FORMAT_IN if the format can be read, FE_FORMAT_OUT if it can be
+ *  written back.
+ * yuv: The samples are YUV, else RGB.
+ * hsub, vsub: Chroma subsampling, also for packed formats.
+ * in_mode, in_fmt, in_ps: Input data mode, format and pixel sequence codes.
+ * out_fmt: Output data format code.
+ */
+struct fe_format {
+	uint32_t			fourcc;
+	uint8_t				dirs;
+	unsigned int			nr_planes;
+	bool				tiled, yuv;
+	uint8_t				hsub, vsub;
+	uint8_t				in_mode, in_fmt, in_ps;
+	uint8_t				out_fmt;
+	struct fe_format_plane		plane[FE_FORMAT_MAX_PLANES];
+};
+
+const struct fe_format *fe_format_find(uint32_t fourcc, uint8_t dirs);
+
+#endif /* SUNXI_FRONT_END_FORMAT_H_ */
@@ -0,0 +1,471 @@
+/*
+ * Copyright (C) 2017 Vitsch Electronics
+ *
+ * Thomas van Kleef <linux-dev@vitsch.nl>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of
+ * the License, or (at your option) any later version.
+ */
+
+/*
+ * The geometry planner turns a conversion into the values of the size,
+ * scaler, line stride and tile offset registers of all channels. It only
+ * does integer math on its arguments, so it is cheap to run per frame and
+ * does not depend on the device; see setup_fe_dma_channels() for writing
+ * the plan to a register image.
+ */
+#include <linux/errno.h>
+#include <linux/kernel.h>
+#include <linux/math64.h>
+#include <linux/string.h>
+#include <uapi/drm/drm_fourcc.h>
+#include "sunxi_front_end_format.h"
+#include "sunxi_front_end_geometry.h"
+#include "sunxi_front_end_registers.h"
+
+/* Only the chroma planes are subsampled. */
+static unsigned int fe_geometry_hsub(const struct fe_format *fmt,
+    unsigned int plane)
+{
+
+	return fmt->plane[plane].channel ? fmt->hsub : 1;
+}
+
+static unsigned int fe_geometry_vsub(const struct fe_format *fmt,
+    unsigned int plane)
+{
+
+	return fmt->plane[plane].channel ? fmt->vsub : 1;
+}
+
+/*
+ * Tiled buffers are padded to whole tiles. A linear buffer may have a larger
+ * pitch0 for its first plane, the other planes follow it the way V4L2 derives
+ * their bytesperline; 0 selects the minimum.
+ */
+static uint32_t fe_geometry_pitch(const struct fe_format *fmt,
+    unsigned int plane, uint32_t width, uint32_t pitch0)
+{
+	uint32_t pitch;
+
+	pitch = DIV_ROUND_UP(width, fe_geometry_hsub(fmt, plane)) *
+	    fmt->plane[plane].cpp;
+	if (fmt->tiled)
+		return ALIGN(pitch, FE_GEO_TILE_SIZE);
+
+	return max(pitch, DIV_ROUND_UP(pitch0, fe_geometry_hsub(fmt, plane)) *
+	    fmt->plane[plane].cpp / fmt->plane[0].cpp);
+}
+
+static uint32_t fe_geometry_size(const struct fe_format *fmt,
+    unsigned int plane, uint32_t width, uint32_t height, uint32_t pitch0)
+{
+	uint32_t lines;
+
+	lines = DIV_ROUND_UP(height, fe_geometry_vsub(fmt, plane));
+	if (fmt->tiled)
+		lines = ALIGN(lines, FE_GEO_TILE_SIZE);
+
+	return fe_geometry_pitch(fmt, plane, width, pitch0) * lines;
+}
+
+static bool fe_geometry_size_valid(uint32_t width, uint32_t height)
+{
+
+	return width >= FE_GEO_MIN_SIZE && width <= FE_GEO_MAX_SIZE &&
+	    height >= FE_GEO_MIN_SIZE && height <= FE_GEO_MAX_SIZE;
+}
+
+/*
+ * The factor is rounded down, so the scaler never reads past the input.
+ */
+static int fe_geometry_fact(uint32_t in, uint32_t out, uint32_t *fact)
+{
+	uint64_t val;
+
+	val = div_u64((uint64_t)in << 16, out);
+	if (val > FE_GEO_MAX_FACT)
+		return -ERANGE;
+
+	*fact = val;
+	return 0;
+}
+
+/*
+ * fe_geometry_plan_plane() - computes how input plane i of a stripe is read
+ *
+ * crop is the part of the input read by the stripe.
+ */
+static void fe_geometry_plan_plane(const struct sunxi_fe_config *cfg,
+    const struct fe_rect *crop, const struct fe_format *fmt,
+    unsigned int i, struct fe_plane_plan *plane, struct fe_stripe_plan *stripe)
+{
+	uint32_t pitch, x, y, width;
+
+	pitch = fe_geometry_pitch(fmt, i, cfg->in_width, 0);
+	x = crop->left / fe_geometry_hsub(fmt, i) * fmt->plane[i].cpp;
+	y = crop->top / fe_geometry_vsub(fmt, i);
+	width = DIV_ROUND_UP(crop->width, fe_geometry_hsub(fmt, i)) *
+	    fmt->plane[i].cpp;
+
+	plane->idma = fmt->plane[i].dma;
+
+	if (!fmt->tiled) {
+		stripe->in_offset[i] = y * pitch + x;
+		stripe->tb_off[i] = 0;
+		plane->linestride = pitch;
+		return;
+	}
+
+	/*
+	 * A row of tiles holds FE_GEO_TILE_SIZE lines of the plane. The
+	 * buffer address points to the tile holding the first pixel, the
+	 * tile offsets give the position of the first and the last pixel
+	 * within their tiles.
+	 */
+	stripe->in_offset[i] = (y / FE_GEO_TILE_SIZE) * pitch *
+	    FE_GEO_TILE_SIZE +
+	    (x / FE_GEO_TILE_SIZE) * FE_GEO_TILE_SIZE * FE_GEO_TILE_SIZE;
+	stripe->tb_off[i] = DEFE_TB_OFFSETS((x + width - 1) % FE_GEO_TILE_SIZE,
+	    y % FE_GEO_TILE_SIZE, x % FE_GEO_TILE_SIZE);
+	plane->linestride = DEFE_TILED_LINESTRIDE(pitch, FE_GEO_TILE_SIZE);
+}
+
+/*
+ * fe_geometry_plan_stripe() - computes what a channel does for a stripe
+ *
+ * The stripe produces out_width pixels from out_x on and the channel reads
+ * from in_x on. The initial phase puts the first pixel where it would be
+ * without stripes, so the factor of the whole frame is kept.
+ */
+static int fe_geometry_plan_stripe(const struct fe_chan_plan *chan,
+    uint32_t in_x, uint32_t out_x, uint32_t out_width,
+    struct fe_stripe_chan *stripe)
+{
+	uint64_t pos;
+	uint32_t end;
+
+	pos = (uint64_t)out_x * chan->horz_fact;
+	end = DIV_ROUND_UP_ULL((uint64_t)(out_x + out_width) *
+	    chan->horz_fact, 1 << 16) + FE_GEO_STRIPE_BORDER;
+
+	if (pos < ((uint64_t)in_x << 16) ||
+	    pos - ((uint64_t)in_x << 16) > FE_GEO_MAX_PHASE ||
+	    in_x >= chan->in_width)
+		return -ERANGE;
+
+	stripe->in_width = min(end, chan->in_width) - in_x;
+	stripe->out_width = out_width;
+	stripe->horz_phase = pos - ((uint64_t)in_x << 16);
+	return 0;
+}
+
+/*
+ * fe_geometry_plan() - computes the register plan of a conversion
+ *
+ * Validates the conversion against the hardware limits first. Returns
+ * -EINVAL for an unsupported format, a size or crop out of range, and
+ * -ERANGE for a scale factor the scaler can not hold. Outputs wider than
+ * FE_GEO_MAX_OUT_WIDTH get more than one stripe.
+ */
+int fe_geometry_plan(const struct sunxi_fe_config *cfg,
+    struct fe_geometry *geo)
+{
+	const struct fe_format *in, *out;
+	struct fe_stripe_plan *stripe;
+	struct fe_chan_plan *chan;
+	struct fe_rect crop, fcrop, compose, rect;
+	unsigned int i, s, nr_fields;
+	uint32_t start, pitch, width, in_x, out_x, out_width;
+	int ret;
+
+	in = fe_format_find(cfg->input_fmt, FE_FORMAT_IN);
+	out = fe_format_find(cfg->output_fmt, FE_FORMAT_OUT);
+	if (!in || !out)
+		return -EINVAL;
+
+	/* The converter only turns YUV into RGB. */
+	if (out->yuv && !in->yuv)
+		return -EINVAL;
+
+	if ((cfg->in_buffers && cfg->in_buffers != 1 &&
+	    cfg->in_buffers != in->nr_planes) ||
+	    (cfg->out_buffers && cfg->out_buffers != 1 &&
+	    cfg->out_buffers != out->nr_planes))
+		return -EINVAL;
+
+	if (!fe_geometry_size_valid(cfg->in_width, cfg->in_height) ||
+	    !fe_geometry_size_valid(cfg->out_width, cfg->out_height))
+		return -EINVAL;
+
+	crop = cfg->crop;
+	if (!crop.width || !crop.height) {
+		crop.left = 0;
+		crop.top = 0;
+		crop.width = cfg->in_width;
+		crop.height = cfg->in_height;
+	}
+
+	/* Sizes first, the bounds below must not wrap. */
+	if (!fe_geometry_size_valid(crop.width, crop.height) ||
+	    crop.width > cfg->in_width || crop.height > cfg->in_height ||
+	    crop.left > cfg->in_width - crop.width ||
+	    crop.top > cfg->in_height - crop.height)
+		return -EINVAL;
+
+	/* Chroma samples, also those of packed formats, must not be split. */
+	if ((crop.left % in->hsub) || (crop.top % in->vsub))
+		return -EINVAL;
+
+	/*
+	 * The channels scale a single field. Each field must hold whole
+	 * chroma lines and the crop has to start at a top field line.
+	 */
+	fcrop = crop;
+	nr_fields = 1;
+	if (cfg->field != FE_GEO_FIELD_NONE) {
+		if (cfg->field != FE_GEO_FIELD_INTERLACED &&
+		    cfg->field != FE_GEO_FIELD_SEQ)
+			return -EINVAL;
+
+		nr_fields = FE_GEO_NR_FIELDS;
+		if (in->tiled || (cfg->in_height % (nr_fields * in->vsub)) ||
+		    (crop.top % (nr_fields * in->vsub)) ||
+		    (crop.height % (nr_fields * in->vsub)))
+			return -EINVAL;
+
+		fcrop.top /= nr_fields;
+		fcrop.height /= nr_fields;
+		if (!fe_geometry_size_valid(fcrop.width, fcrop.height))
+			return -EINVAL;
+	}
+
+	compose = cfg->compose;
+	if (!compose.width || !compose.height) {
+		compose.left = 0;
+		compose.top = 0;
+		compose.width = cfg->out_width;
+		compose.height = cfg->out_height;
+	}
+
+	if (!fe_geometry_size_valid(compose.width, compose.height) ||
+	    compose.width > cfg->out_width ||
+	    compose.height > cfg->out_height ||
+	    compose.left > cfg->out_width - compose.width ||
+	    compose.top > cfg->out_height - compose.height ||
+	    (compose.left % out->hsub) || (compose.top % out->vsub))
+		return -EINVAL;
+
+	memset(geo, 0, sizeof(*geo));
+	geo->nr_planes = in->nr_planes;
+	geo->tiled = in->tiled;
+	geo->csc = in->yuv && !out->yuv;
+	geo->field = cfg->field;
+	geo->input_fmt = DEFE_INPUT_DATA_MOD(in->in_mode) |
+	    DEFE_INPUT_DATA_FMT(in->in_fmt) |
+	    DEFE_INPUT_PS(in->in_ps);
+	/* The hardware reads one field of interleaved lines by itself. */
+	if (cfg->field == FE_GEO_FIELD_INTERLACED)
+		geo->input_fmt |= DEFE_INPUT_SCAN_MOD(DEFE_INP_SCAN_INTERLACE);
+	geo->output_fmt = DEFE_OUTPUT_DATA_FMT(out->out_fmt);
+
+	/*
+	 * The write-back only needs its own line stride if the lines of the
+	 * frame are longer than those of the rectangle or of a stripe.
+	 */
+	geo->nr_out_planes = out->nr_planes;
+	for (i = 0; i < out->nr_planes; i++) {
+		pitch = fe_geometry_pitch(out, i, cfg->out_width,
+		    cfg->out_pitch);
+		if (pitch != fe_geometry_pitch(out, i, compose.width, 0) ||
+		    compose.width > FE_GEO_MAX_OUT_WIDTH)
+			geo->wb_linestride = true;
+
+		geo->out_plane[i].idma = out->plane[i].dma;
+		geo->out_plane[i].linestride = pitch;
+		if (cfg->out_buffers != 1)
+			geo->out_plane[i].buffer = i;
+	}
+
+	/*
+	 * Channel 1 scales the chroma, also if it has no plane of its own.
+	 * Planar YUV is written back with subsampled chroma. Scaling each
+	 * field to a whole frame and shifting the bottom one by half a field
+	 * line gives a bob deinterlace.
+	 */
+	for (i = 0; i < FE_GEO_NR_CHANNELS; i++) {
+		chan = &geo->chan[i];
+
+		if (i) {
+			chan->in_width = DIV_ROUND_UP(fcrop.width,
+			    in->hsub);
+			chan->in_height = DIV_ROUND_UP(fcrop.height,
+			    in->vsub);
+			chan->out_width = DIV_ROUND_UP(compose.width,
+			    out->hsub);
+			chan->out_height = DIV_ROUND_UP(compose.height,
+			    out->vsub);
+		} else {
+			chan->in_width = fcrop.width;
+			chan->in_height = fcrop.height;
+			chan->out_width = compose.width;
+			chan->out_height = compose.height;
+		}
+
+		if (cfg->field != FE_GEO_FIELD_NONE)
+			chan->field_phase = FE_GEO_BOTTOM_PHASE;
+
+		ret = fe_geometry_fact(chan->in_width, chan->out_width,
+		    &chan->horz_fact);
+		if (ret)
+			return ret;
+
+		ret = fe_geometry_fact(chan->in_height, chan->out_height,
+		    &chan->vert_fact);
+		if (ret)
+			return ret;
+	}
+
+	/*
+	 * Outputs wider than the line buffers are split into stripes that
+	 * start at a whole chroma sample of the output. Each stripe starts
+	 * reading FE_GEO_STRIPE_BORDER pixels before the first input pixel it
+	 * needs, at a whole chroma sample of the input.
+	 */
+	geo->nr_stripes = DIV_ROUND_UP(compose.width, FE_GEO_MAX_OUT_WIDTH);
+	width = ALIGN(DIV_ROUND_UP(compose.width, geo->nr_stripes), out->hsub);
+	for (s = 0; s < geo->nr_stripes; s++) {
+		stripe = &geo->stripe[s];
+		out_x = s * width;
+		out_width = min(width, compose.width - out_x);
+		in_x = div_u64((uint64_t)out_x * geo->chan[0].horz_fact,
+		    1 << 16);
+		in_x = rounddown(in_x > FE_GEO_STRIPE_BORDER ?
+		    in_x - FE_GEO_STRIPE_BORDER : 0, in->hsub);
+
+		ret = fe_geometry_plan_stripe(&geo->chan[0], in_x, out_x,
+		    out_width, &stripe->chan[0]);
+		if (ret)
+			return ret;
+
+		ret = fe_geometry_plan_stripe(&geo->chan[1], in_x / in->hsub,
+		    out_x / out->hsub, DIV_ROUND_UP(out_width, out->hsub),
+		    &stripe->chan[1]);
+		if (ret)
+			return ret;
+
+		/*
+		 * Sequential fields are read as separate pictures, interlaced
+		 * ones in frame lines.
+		 */
+		rect = cfg->field == FE_GEO_FIELD_SEQ ? fcrop : crop;
+		rect.left += in_x;
+		rect.width = stripe->chan[0].in_width;
+
+		/* A single buffer holds the planes one after another. */
+		start = 0;
+		for (i = 0; i < in->nr_planes; i++) {
+			fe_geometry_plan_plane(cfg, &rect, in, i,
+			    &geo->plane[i], stripe);
+			if (cfg->field == FE_GEO_FIELD_SEQ)
+				geo->plane[i].field_offset = fe_geometry_size(
+				    in, i, cfg->in_width, cfg->in_height, 0) /
+				    nr_fields;
+
+			if (cfg->in_buffers == 1) {
+				stripe->in_offset[i] += start;
+				start += fe_geometry_size(in, i, cfg->in_width,
+				    cfg->in_height, 0);
+			} else {
+				geo->plane[i].buffer = i;
+			}
+		}
+
+		/*
+		 * The output is written to the compose rectangle of the
+		 * frame.
+		 */
+		start = 0;
+		for (i = 0; i < out->nr_planes; i++) {
+			pitch = geo->out_plane[i].linestride;
+			stripe->out_offset[i] = start +
+			    compose.top / fe_geometry_vsub(out, i) * pitch +
+			    (compose.left + out_x) / fe_geometry_hsub(out, i) *
+			    out->plane[i].cpp;
+
+			if (cfg->out_buffers == 1)
+				start += fe_geometry_size(out, i,
+				    cfg->out_width, cfg->out_height,
+				    cfg->out_pitch);
+		}
+	}
+
+	return 0;
+}
+
+/*
+ * fe_geometry_buffers() - computes the buffers of an input or output frame
+ *
+ * Fills in the line pitch and the size of each buffer and returns the number
+ * of buffers. With nr_buffers 1 all planes are in a single buffer, else
+ * every plane has a buffer of its own. On entry pitch[0] may hold a larger
+ * pitch for the first plane, or 0.
+ */
+int fe_geometry_buffers(uint32_t fmt, unsigned int nr_buffers, uint32_t width,
+    uint32_t height, uint32_t *pitch, uint32_t *size)
+{
+	const struct fe_format *format;
+	uint32_t pitch0;
+	unsigned int i;
+
+	format = fe_format_find(fmt, 0);
+	if (!format)
+		return -EINVAL;
+
+	pitch0 = pitch[0];
+	if (nr_buffers == 1) {
+		pitch[0] = fe_geometry_pitch(format, 0, width, pitch0);
+		size[0] = 0;
+		for (i = 0; i < format->nr_planes; i++)
+			size[0] += fe_geometry_size(format, i, width, height,
+			    pitch0);
+		return 1;
+	}
+
+	for (i = 0; i < format->nr_planes; i++) {
+		pitch[i] = fe_geometry_pitch(format, i, width, pitch0);
+		size[i] = fe_geometry_size(format, i, width, height, pitch0);
+	}
+
+	return format->nr_planes;
+}
+
+/*
+ * fe_geometry_in_extent() - bytes of input plane i read for a conversion
+ *
+ * Counted from the start of the plane up to the end of the last line, or
+ * row of tiles, that holds part of the crop. Returns 0 for an unknown format
+ * or plane.
+ */
+uint32_t fe_geometry_in_extent(const struct sunxi_fe_config *cfg,
+    unsigned int i)
+{
+	const struct fe_format *fmt;
+	uint32_t lines;
+
+	fmt = fe_format_find(cfg->input_fmt, FE_FORMAT_IN);
+	if (!fmt || i >= fmt->nr_planes)
+		return 0;
+
+	if (cfg->crop.width && cfg->crop.height)
+		lines = cfg->crop.top + cfg->crop.height;
+	else
+		lines = cfg->in_height;
+	lines = DIV_ROUND_UP(lines, fe_geometry_vsub(fmt, i));
+	if (fmt->tiled)
+		lines = ALIGN(lines, FE_GEO_TILE_SIZE);
+
+	return fe_geometry_pitch(fmt, i, cfg->in_width, 0) * lines;
+}
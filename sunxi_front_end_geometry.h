@@ -0,0 +1,184 @@
+/*
+ * Copyright (C) 2017 Vitsch Electronics
+ *
+ * Thomas van Kleef <linux-dev@vitsch.nl>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of
+ * the License, or (at your option) any later version.
+ */
+
+#ifndef SUNXI_FRONT_END_GEOMETRY_H_
+#define SUNXI_FRONT_END_GEOMETRY_H_
+
+#include <linux/types.h>
+#include "sunxi_front_end_format.h"
+
+/*
+ * Hardware limits. The size fields are 13 bits wide and hold the size - 1.
+ * The scaler line buffers hold FE_GEO_MAX_OUT_WIDTH pixels of a scaled line,
+ * and the integer part of a scale factor is 8 bits wide. The initial phase
+ * is signed 4.16 fixed point.
+ */
+#define FE_GEO_MIN_SIZE				8
+#define FE_GEO_MAX_SIZE				8192
+#define FE_GEO_MAX_OUT_WIDTH			2048
+#define FE_GEO_MAX_FACT				((256 << 16) - 1)
+#define FE_GEO_MAX_PHASE			((8 << 16) - 1)
+
+/*
+ * Wider outputs are scaled in vertical stripes of at most
+ * FE_GEO_MAX_OUT_WIDTH pixels, FE_GEO_MAX_SIZE / FE_GEO_MAX_OUT_WIDTH at
+ * most. Each stripe reads FE_GEO_STRIPE_BORDER extra input pixels on both
+ * sides for the filter taps, so the seams can not be seen.
+ */
+#define FE_GEO_MAX_STRIPES			4
+#define FE_GEO_STRIPE_BORDER			4
+
+#define FE_GEO_MAX_PLANES			FE_FORMAT_MAX_PLANES
+#define FE_GEO_NR_CHANNELS			2
+#define FE_GEO_TILE_SIZE			32
+
+/*
+ * Field layouts of the input. Interlaced fields are interleaved line by
+ * line, sequential fields are stored one after another in each plane. The
+ * top field comes first in time.
+ */
+#define FE_GEO_FIELD_NONE			0
+#define FE_GEO_FIELD_INTERLACED			1
+#define FE_GEO_FIELD_SEQ			2
+#define FE_GEO_NR_FIELDS			2
+
+/*
+ * The lines of the bottom field lie half a field line below those of the
+ * top field, in 16.16 fixed point.
+ */
+#define FE_GEO_BOTTOM_PHASE			(-(1 << 15))
+
+/*
+ * fe_rect A rectangle in pixels.
+ */
+struct fe_rect {
+	uint32_t			left, top;
+	uint32_t			width, height;
+};
+
+/*
+ * sunxi_fe_config Geometry and formats of a conversion.
+ * in_width, in_height: Input frame size in pixels.
+ * in_buffers: Buffers holding the input planes, 1 if a single buffer holds
+ *  all planes, 0 if each plane has a buffer of its own.
+ * field: FE_GEO_FIELD_* layout of the input. Each field of an interlaced
+ *  input is scaled to a whole output frame.
+ * crop: Part of the input that is scaled, all zero for the whole frame.
+ *  Given in frame lines, also for field based input.
+ * out_width, out_height: Output frame size in pixels.
+ * out_pitch: Line pitch of the first output plane in bytes, 0 for the
+ *  minimum.
+ * compose: Part of the output frame that is written, all zero for the whole
+ *  frame.
+ * out_buffers: Buffers holding the output planes, like in_buffers.
+ * input_fmt, output_fmt: DRM fourcc of the input and output.
+ */
+struct sunxi_fe_config {
+	uint32_t			in_width, in_height;
+	unsigned int			in_buffers;
+	unsigned int			field;
+	struct fe_rect			crop;
+	uint32_t			out_width, out_height;
+	uint32_t			out_pitch;
+	struct fe_rect			compose;
+	unsigned int			out_buffers;
+	uint32_t			input_fmt, output_fmt;
+};
+
+/*
+ * fe_plane_plan How a dma channel reads or writes its plane.
+ * buffer: Buffer plane that holds the plane.
+ * idma: Input dma channel that reads the plane, or write-back channel.
+ * linestride: Line stride register value.
+ * field_offset: Byte offset of the bottom field from the top field of
+ *  sequential fields.
+ */
+struct fe_plane_plan {
+	unsigned int			buffer;
+	unsigned int			idma;
+	uint32_t			linestride;
+	uint32_t			field_offset;
+};
+
+/*
+ * fe_chan_plan Setup of a scaler channel.
+ * in_width, in_height: Samples read by the channel.
+ * out_width, out_height: Pixels produced by the channel.
+ * horz_fact, vert_fact: Scale factors in 16.16 fixed point.
+ * field_phase: Vertical phase of the bottom field in 16.16 fixed point.
+ */
+struct fe_chan_plan {
+	uint32_t			in_width, in_height;
+	uint32_t			out_width, out_height;
+	uint32_t			horz_fact, vert_fact;
+	int32_t				field_phase;
+};
+
+/*
+ * fe_stripe_chan What a scaler channel does for a stripe.
+ * in_width: Samples read by the channel.
+ * out_width: Pixels produced by the channel.
+ * horz_phase: Horizontal phase of the first pixel in 16.16 fixed point.
+ */
+struct fe_stripe_chan {
+	uint32_t			in_width, out_width;
+	uint32_t			horz_phase;
+};
+
+/*
+ * fe_stripe_plan Setup of a vertical stripe of the output.
+ * in_offset, out_offset: Byte offset of the first pixel of each input and
+ *  output plane from the start of its buffer, to be added to the buffer
+ *  address of every frame.
+ * tb_off: Tile-based offset register value per input plane, zero for linear
+ *  input.
+ * chan: Part of the scaling done by each channel.
+ */
+struct fe_stripe_plan {
+	uint32_t			in_offset[FE_GEO_MAX_PLANES];
+	uint32_t			out_offset[FE_GEO_MAX_PLANES];
+	uint32_t			tb_off[FE_GEO_MAX_PLANES];
+	struct fe_stripe_chan		chan[FE_GEO_NR_CHANNELS];
+};
+
+/*
+ * fe_geometry Register plan of a conversion, see fe_geometry_plan().
+ * input_fmt, output_fmt: Input and output format register values.
+ * csc: The YUV input has to be converted to RGB.
+ * field: FE_GEO_FIELD_* layout of the input, the channels scale one field.
+ * out_plane: Write-back of the output planes, linestride holds the pitch.
+ * wb_linestride: The write-back needs the line strides of out_plane.
+ * chan: Setup of the channels for the whole frame.
+ * nr_stripes: Hardware passes of a frame, one for each stripe.
+ */
+struct fe_geometry {
+	unsigned int			nr_planes;
+	bool				tiled;
+	uint32_t			input_fmt, output_fmt;
+	bool				csc;
+	unsigned int			field;
+	struct fe_plane_plan		plane[FE_GEO_MAX_PLANES];
+	unsigned int			nr_out_planes;
+	struct fe_plane_plan		out_plane[FE_GEO_MAX_PLANES];
+	bool				wb_linestride;
+	struct fe_chan_plan		chan[FE_GEO_NR_CHANNELS];
+	unsigned int			nr_stripes;
+	struct fe_stripe_plan		stripe[FE_GEO_MAX_STRIPES];
+};
+
+int fe_geometry_plan(const struct sunxi_fe_config *cfg,
+    struct fe_geometry *geo);
+int fe_geometry_buffers(uint32_t fmt, unsigned int nr_buffers, uint32_t width,
+    uint32_t height, uint32_t *pitch, uint32_t *size);
+uint32_t fe_geometry_in_extent(const struct sunxi_fe_config *cfg,
+    unsigned int i);
+
+#endif /* SUNXI_FRONT_END_GEOMETRY_H_ */
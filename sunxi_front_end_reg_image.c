@@ -0,0 +1,82 @@
+/*
+ * Copyright (C) 2017 Vitsch Electronics
+ *
+ * Thomas van Kleef <linux-dev@vitsch.nl>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of
+ * the License, or (at your option) any later version.
+ */
+#include <linux/regmap.h>
+#include <linux/string.h>
+#include "sunxi_front_end.h"
+#include "sunxi_front_end_reg_image.h"
+
+void fe_reg_image_init(struct fe_reg_image *img)
+{
+
+	memset(img->val, 0, sizeof(img->val));
+	bitmap_zero(img->used, FE_REG_IMAGE_NR_REGS);
+}
+
+int fe_reg_image_write(struct fe_reg_image *img, uint32_t reg, uint32_t val)
+{
+	uint32_t i;
+
+	i = reg / 4;
+	if ((reg % 4) || i >= FE_REG_IMAGE_NR_REGS) {
+		printk("Register 0x%x is not part of the register image\n",
+		    reg);
+		return -EINVAL;
+	}
+
+	img->val[i] = val;
+	set_bit(i, img->used);
+	return 0;
+}
+
+/*
+ * fe_reg_image_read() - returns the value of reg, 0 if the image doesn't set it
+ */
+uint32_t fe_reg_image_read(const struct fe_reg_image *img, uint32_t reg)
+{
+	uint32_t i;
+
+	i = reg / 4;
+	if ((reg % 4) || i >= FE_REG_IMAGE_NR_REGS || !test_bit(i, img->used))
+		return 0;
+
+	return img->val[i];
+}
+
+/*
+ * fe_reg_image_apply() - writes the registers of img that differ from hw
+ *
+ * Returns the number of registers written or a negative error code.
+ */
+int fe_reg_image_apply(struct regmap *regs, const struct fe_reg_image *img,
+    struct fe_reg_image *hw)
+{
+	unsigned int i;
+	int ret, count;
+
+	count = 0;
+	for_each_set_bit(i, img->used, FE_REG_IMAGE_NR_REGS) {
+		if (test_bit(i, hw->used) && hw->val[i] == img->val[i])
+			continue;
+
+		ret = regmap_write(regs, i * 4, img->val[i]);
+		if (ret) {
+			/* The value in the hardware is unknown now. */
+			clear_bit(i, hw->used);
+			return ret;
+		}
+		hw->val[i] = img->val[i];
+		set_bit(i, hw->used);
+		count++;
+	}
+
+	PRINT_DE_FE("de_fe wrote %d registers\n", count);
+	return count;
+}
@@ -0,0 +1,48 @@
+/*
+ * Copyright (C) 2017 Vitsch Electronics
+ *
+ * Thomas van Kleef <linux-dev@vitsch.nl>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of
+ * the License, or (at your option) any later version.
+ */
+
+#ifndef SUNXI_FRONT_END_REG_IMAGE_H_
+#define SUNXI_FRONT_END_REG_IMAGE_H_
+
+#include <linux/bitmap.h>
+#include <linux/regmap.h>
+
+/*
+ * A register image holds the values a context wants in the DEFE registers:
+ * input/output formats, CSC, tile offsets, line strides and the scaler
+ * setup of both channels. These all live below FE_REG_IMAGE_SIZE.
+ * Per-frame registers such as the buffer addresses and the frame control
+ * register are never part of an image.
+ *
+ * The device keeps an image of the values the hardware currently holds, so
+ * that switching to another context only writes the registers that differ.
+ */
+#define FE_REG_IMAGE_SIZE			0x220
+#define FE_REG_IMAGE_NR_REGS			(FE_REG_IMAGE_SIZE / 4)
+
+/*
+ * fe_reg_image
+ * val: register values, indexed by register offset / 4.
+ * used: registers that have a value in this image. For the hardware image
+ *  this marks the registers of which the value is known.
+ */
+struct fe_reg_image {
+	uint32_t			val[FE_REG_IMAGE_NR_REGS];
+	DECLARE_BITMAP(used, FE_REG_IMAGE_NR_REGS);
+};
+
+void fe_reg_image_init(struct fe_reg_image *img);
+int fe_reg_image_write(struct fe_reg_image *img, uint32_t reg, uint32_t val);
+uint32_t fe_reg_image_read(const struct fe_reg_image *img, uint32_t reg);
+int fe_reg_image_apply(struct regmap *regs, const struct fe_reg_image *img,
+    struct fe_reg_image *hw);
+
+#endif /* SUNXI_FRONT_END_REG_IMAGE_H_ */
@@ -51,10 +51,18 @@
 /* DEFE Frame Process Control Register */
 #define DEFE_FRM_CTRL_REG		0x4
 #define DEFE_FRM_START_BIT(x)		MASK_BIT(x, 16)
+#define DEFE_WB_EN(x)			MASK_BIT(x, 2)
 #define DEFE_COEF_RDY_EN(x)		MASK_BIT(x, 1)
 #define DEFE_REG_RDY_EN(x)		MASK_BIT(x, 0)
 #define DEFE_REG_RDY_MASK		BIT(0)
-#define DEFE_FRM_START_START_MASK	BIT(1)
+#define DEFE_COEF_RDY_MASK		BIT(1)
+#define DEFE_WB_EN_MASK			BIT(2)
+#define DEFE_FRM_START_START_MASK	BIT(16)
+/* Output to the back-end, 0 enables it. */
+#define DEFE_OUT_CTRL(x)		MASK_BIT(x, 11)
+#define DEFE_OUT_CTRL_MASK		BIT(11)
+#define DEFE_OUT_CTRL_BE_EN		0
+#define DEFE_OUT_CTRL_BE_DIS		1
 
 /* DEFE CSC By-Pass Register */
 #define DEFE_BYPASS_REG			0x8
@@ -66,6 +74,9 @@
 /* DEFE Input Channel 1 Buffer Address Register */
 #define DEFE_BUF_ADDR1_REG		0x24
 
+/* DEFE Input Channel 2 Buffer Address Register */
+#define DEFE_BUF_ADDR2_REG		0x28
+
 /* DEFE Channel 0 Tile-Based Offset Register */
 #define DEFE_TB_OFF0_REG		0x30
 #define DEFE_TB_OFF1_REG		0x34
@@ -78,6 +89,19 @@
 /* DEFE Channel 1 Tile-Based Offset Register */
 #define DEFE_TB_OFF1_REG		0x34
 
+/* DEFE Channel 2 Tile-Based Offset Register */
+#define DEFE_TB_OFF2_REG		0x38
+
+/*
+ * DEFE Field Sequence Register. In interlace scan mode every frame start
+ * reads the fields of FIELD_CNT, bit n selects the bottom field for the n-th
+ * of VALID_FIELD_CNT + 1 passes.
+ */
+#define DEFE_FIELD_CTRL_REG		0x2C
+#define DEFE_FIELD_LOOP_MOD(x)		MASK_BIT(x, 12)
+#define DEFE_VALID_FIELD_CNT(x)		MASK_BITS(x, 0x7, 8)
+#define DEFE_FIELD_CNT(x)		MASK_BITS(x, 0xff, 0)
+
 /* DEFE Channel 0 Line Stride Register */
 #define DEFE_LINESTRD0_REG		0x40
 #define DEFE_TILED_LINESTRIDE(width, tile_length)	((tile_length * width) \
@@ -86,14 +110,20 @@
 /* DEFE Channel 1 Line Stride Register */
 #define DEFE_LINESTRD1_REG		0x44
 
+/* DEFE Channel 2 Line Stride Register */
+#define DEFE_LINESTRD2_REG		0x48
+
 /* DEFE Input Format Register */
 #define DEFE_INPUT_FMT_REG		0x4C
 #define DEFE_INPUT_SCAN_MOD(x)		MASK_BIT(x, 12)
-#define DEFE_INP_SCAN_INTERLACE 	0
-#define DEFE_INP_SCAN_PROGRESSIVE	1
+#define DEFE_INP_SCAN_PROGRESSIVE	0
+#define DEFE_INP_SCAN_INTERLACE		1
 #define DEFE_INPUT_DATA_MOD(x) 		MASK_BITS(x, 0x7, 8)
-#define DEFE_MOD_TILE_BASED_UV_COMBINED 0x6
 #define DEFE_MOD_NON_TILE_BASED_PLANAR 	0x0
+#define DEFE_MOD_NON_TILE_BASED_INTERLEAVED 0x1
+#define DEFE_MOD_NON_TILE_BASED_UV_COMBINED 0x2
+#define DEFE_MOD_TILE_BASED_PLANAR	0x4
+#define DEFE_MOD_TILE_BASED_UV_COMBINED 0x6
 #define DEFE_INPUT_DATA_FMT(x)		MASK_BITS(x, 0x7, 4)
 #define DEFE_INP_FMT_YUV444		0x0
 #define DEFE_INP_FMT_YUV422		0x1
@@ -102,14 +132,51 @@
 #define DEFE_INP_FMT_CSI_RGB_DATA	0x4
 #define DEFE_INP_FMT_RGB888		0x5
 #define DEFE_INPUT_PS(x) 		MASK_BITS(x, 0x3, 0)
+/* UV combined modes */
 #define DEFE_INP_PS_V1U1V0U0		0x0
 #define DEFE_INP_PS_U1V1U0V0		0x1
+/* Interleaved YUV422 */
+#define DEFE_INP_PS_YUYV		0x0
+#define DEFE_INP_PS_UYVY		0x1
+#define DEFE_INP_PS_YVYU		0x2
+#define DEFE_INP_PS_VYUY		0x3
+/* Interleaved RGB888, from the most significant byte of a pixel */
+#define DEFE_INP_PS_BGRA		0x0
 #define DEFE_INP_PS_ARGB		0x1
 
+/* DEFE Write-Back Channel 0..2 Address Registers */
+#define DEFE_WB_ADDR0_REG		0x50
+#define DEFE_WB_ADDR1_REG		0x54
+#define DEFE_WB_ADDR2_REG		0x58
+
 /* DEFE Output Format Register */
 #define DEFE_OUTPUT_FMT_REG		0x5C
-#define DEFE_OUTPUT_DATA_FMT(x)		MASK_BITS(x, 0x3, 0)
+#define DEFE_OUTPUT_DATA_FMT(x)		MASK_BITS(x, 0x7, 0)
+#define DEFE_OUT_FMT_PLANAR_RGB888	0x00
+#define DEFE_OUT_FMT_INTERL_BGRA8888	0x01/*A = padded 0xff*/
 #define DEFE_OUT_FMT_INTERL_ARGB8888	0x02/*A = padded 0xff*/
+#define DEFE_OUT_FMT_PLANAR_YUV444	0x04
+#define DEFE_OUT_FMT_PLANAR_YUV420	0x05
+#define DEFE_OUT_FMT_PLANAR_YUV422	0x06
+#define DEFE_OUT_FMT_PLANAR_YUV411	0x07
+
+/* DEFE Interrupt Enable Register */
+#define DEFE_INT_EN_REG			0x60
+#define DEFE_WB_INT_EN(x)		MASK_BIT(x, 7)
+#define DEFE_WB_INT_EN_MASK		BIT(7)
+#define DEFE_REG_LOAD_INT_EN(x)		MASK_BIT(x, 9)
+#define DEFE_REG_LOAD_INT_EN_MASK	BIT(9)
+
+/* DEFE Interrupt Status Register, bits are cleared by writing a 1 */
+#define DEFE_INT_STATUS_REG		0x64
+#define DEFE_WB_INT_STATUS		BIT(7)
+#define DEFE_REG_LOAD_INT_STATUS	BIT(9)
+
+/* DEFE Status Register */
+#define DEFE_STATUS_REG			0x68
+#define DEFE_STATUS_FRM_BUSY		BIT(0)
+#define DEFE_STATUS_WB_BUSY		BIT(1)
+#define DEFE_STATUS_CFG_PENDING		BIT(2)
 
 /* DEFE Channel 0 Input Size Register */
 #define DEFE_CH0_INSIZE_REG		0x100
@@ -134,6 +201,15 @@
 #define DEFE_CHX_VERTFACT_INT		DEFE_CHX_HORZFACT_INT
 #define DEFE_CHX_VERTFACT_FRACT		DEFE_CHX_HORZFACT_FRACT
 
+/*
+ * DEFE Channel 0 Initial Phase Registers, signed 4.16 fixed point. In
+ * interlace scan mode VERTPHASE1 is used for the bottom field.
+ */
+#define DEFE_CH0_HORZPHASE_REG		0x110
+#define DEFE_CH0_VERTPHASE0_REG		0x114
+#define DEFE_CH0_VERTPHASE1_REG		0x118
+#define DEFE_CHX_PHASE(x)		MASK_BITS(x, 0xfffff, 0)
+
 #define DEFE_CH1_INSIZE_REG		0x200
 #define DEFE_CH1_OUTSIZE_REG		0x204
 
@@ -155,6 +231,9 @@
  */
 #define DEFE_CH1_HORZFACT_REG		0x208
 #define DEFE_CH1_VERTFACT_REG		0x20C
+#define DEFE_CH1_HORZPHASE_REG		0x210
+#define DEFE_CH1_VERTPHASE0_REG		0x214
+#define DEFE_CH1_VERTPHASE1_REG		0x218
 
 /*
  * These are the names of the coefficient registers as defined in the Allwinner
@@ -198,16 +277,32 @@
 #define DEFE_CSC_COEF_MAG(x)		((x) < 0 ? ((x) + 0x2000) : (x))
 #define DEFE_CSC_COEF_CONST(x)		((x) < 0 ? ((x) + 0x4000) : (x))
 
+/*
+ * DEFE Write-Back Line Stride Registers. Without the enable bit the
+ * write-back packs the lines of the output; with it every write-back
+ * channel uses the stride in bytes of its own register.
+ */
+#define DEFE_WB_LINESTRD_EN_REG		0xD0
+#define DEFE_WB_LINESTRD_EN(x)		MASK_BIT(x, 0)
+#define DEFE_WB_LINESTRD0_REG		0xD4
+#define DEFE_WB_LINESTRD1_REG		0xD8
+#define DEFE_WB_LINESTRD2_REG		0xDC
+
 /*
  * These are the offsets for the horizontal and vertical coefficients.
  * These are taken from u-boot settings.
+ * Each bank holds one register per phase. The banks of channel 1 follow
+ * those of channel 0 at DEFE_CH_COEF_OFFSET.
  */
 #define DEFE_CH0_HORZCOEF0	0x400
 #define DEFE_CH0_HORZCOEF1	0x480
 #define DEFE_CH0_VERTCOEF	0x500
-#define DEFE_CH1_HORZCOEF0	0x400
-#define DEFE_CH1_HORZCOEF1	0x480
-#define DEFE_CH1_VERTCOEF	0x500
+#define DEFE_CH1_HORZCOEF0	0x600
+#define DEFE_CH1_HORZCOEF1	0x680
+#define DEFE_CH1_VERTCOEF	0x700
+#define DEFE_CH_COEF_OFFSET	0x200
+#define DEFE_NR_COEF_PHASES	32
+#define DEFE_NR_COEF_CHANNELS	2
 
 
 
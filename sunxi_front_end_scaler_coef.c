@@ -0,0 +1,314 @@
+/*
+ * Copyright (C) 2017 Vitsch Electronics
+ *
+ * Thomas van Kleef <linux-dev@vitsch.nl>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of
+ * the License, or (at your option) any later version.
+ */
+#include <linux/math64.h>
+#include <linux/regmap.h>
+#include <linux/slab.h>
+#include "sunxi_front_end.h"
+#include "sunxi_front_end_registers.h"
+#include "sunxi_front_end_scaler_coef.h"
+
+/*
+ * The sun4i_horz_coef and sun4i_vert_coef tables from u-boot, see README.md.
+ * u-boot interleaves the two horizontal banks, they are split up here so
+ * that every bank can be written with a single bulk write.
+ */
+const struct fe_coef_set fe_coef_sun4i = {
+	.horz0 = {
+		0x40000000, 0x40fe0000, 0x3ffd0000, 0x3ffc0000,
+		0x3efb0000, 0x3dfb0000, 0x3bfa0000, 0x39fa0000,
+		0x38fa0000, 0x36fa0000, 0x33fa0000, 0x31fa0000,
+		0x2ffa0000, 0x2cfa0000, 0x29fa0000, 0x27fb0000,
+		0x24fb0000, 0x21fb0000, 0x1ffc0000, 0x1cfc0000,
+		0x19fd0000, 0x16fd0000, 0x14fd0000, 0x11fe0000,
+		0x0ffe0000, 0x0dfe0000, 0x0afe0000, 0x08ff0000,
+		0x06ff0000, 0x05ff0000, 0x03ff0000, 0x01ff0000,
+	},
+	.horz1 = {
+		0x00000000, 0x0000ff03, 0x0000ff05, 0x0000ff06,
+		0x0000ff08, 0x0000ff09, 0x0000fe0d, 0x0000fe0f,
+		0x0000fe10, 0x0000fe12, 0x0000fd16, 0x0000fd18,
+		0x0000fd1a, 0x0000fc1e, 0x0000fc21, 0x0000fb23,
+		0x0000fb26, 0x0000fb29, 0x0000fa2b, 0x0000fa2e,
+		0x0000fa30, 0x0000fa33, 0x0000fa35, 0x0000fa37,
+		0x0000fa39, 0x0000fa3b, 0x0000fa3e, 0x0000fb3e,
+		0x0000fb40, 0x0000fc40, 0x0000fd41, 0x0000fe42,
+	},
+	.vert = {
+		0x00004000, 0x000140ff, 0x00033ffe, 0x00043ffd,
+		0x00063efc, 0xff083dfc, 0x000a3bfb, 0xff0d39fb,
+		0xff0f37fb, 0xff1136fa, 0xfe1433fb, 0xfe1631fb,
+		0xfd192ffb, 0xfd1c2cfb, 0xfd1f29fb, 0xfc2127fc,
+		0xfc2424fc, 0xfc2721fc, 0xfb291ffd, 0xfb2c1cfd,
+		0xfb2f19fd, 0xfb3116fe, 0xfb3314fe, 0xfa3611ff,
+		0xfb370fff, 0xfb390dff, 0xfb3b0a00, 0xfc3d08ff,
+		0xfc3e0600, 0xfd3f0400, 0xfe3f0300, 0xff400100,
+	},
+};
+
+/*
+ * fe_coef_upload() - writes the three coefficient banks of a channel
+ *
+ * Each bank is a single bulk write, so the regmap lock is taken once per
+ * bank instead of once per register. The new coefficients are only used by
+ * the scaler after COEF_RDY has been set, see fe_coef_upload_all().
+ */
+int fe_coef_upload(struct regmap *regs, uint32_t channel,
+    const struct fe_coef_set *set)
+{
+	uint32_t offset;
+	int ret;
+
+	offset = channel * DEFE_CH_COEF_OFFSET;
+
+	ret = regmap_bulk_write(regs, DEFE_CH0_HORZCOEF0 + offset, set->horz0,
+	    DEFE_NR_COEF_PHASES);
+	if (ret)
+		return ret;
+
+	ret = regmap_bulk_write(regs, DEFE_CH0_HORZCOEF1 + offset, set->horz1,
+	    DEFE_NR_COEF_PHASES);
+	if (ret)
+		return ret;
+
+	return regmap_bulk_write(regs, DEFE_CH0_VERTCOEF + offset, set->vert,
+	    DEFE_NR_COEF_PHASES);
+}
+
+/*
+ * fe_coef_upload_all() - replaces the filters of both scaler channels
+ *
+ * COEF_RDY makes the scaler pick up the new coefficients at the next frame
+ * start. The coefficient RAM is read while a frame is scaled, so this must
+ * only be called while the front-end is idle.
+ */
+int fe_coef_upload_all(struct regmap *regs, const struct fe_coef_set *ch0,
+    const struct fe_coef_set *ch1)
+{
+	int ret;
+
+	ret = fe_coef_upload(regs, 0, ch0);
+	if (ret) {
+		printk("Could not upload channel 0 coefficients.\n");
+		return ret;
+	}
+
+	ret = fe_coef_upload(regs, 1, ch1);
+	if (ret) {
+		printk("Could not upload channel 1 coefficients.\n");
+		return ret;
+	}
+
+	return regmap_update_bits(regs, DEFE_FRM_CTRL_REG,
+	    DEFE_COEF_RDY_EN(ENABLE), DEFE_COEF_RDY_EN(ENABLE));
+}
+
+/*
+ * The taps of a phase add up to FE_COEF_SUM. The horizontal filter has 8
+ * taps, the vertical filter 4. For phase 0 the output pixel sits on the tap
+ * given by the centre.
+ */
+#define FE_COEF_SUM				64
+#define FE_COEF_HORZ_TAPS			8
+#define FE_COEF_HORZ_CENTRE			3
+#define FE_COEF_VERT_TAPS			4
+#define FE_COEF_VERT_CENTRE			1
+#define FE_COEF_PHASE_SHIFT			(16 - 5)
+
+#define FE_COEF_KEY(dir, q)			(((dir) << 8) | (q))
+#define FE_COEF_KEY_DIR(key)			((key) >> 8)
+#define FE_COEF_KEY_RATIO(key)			((key) & 0xff)
+
+/*
+ * fe_coef_key() - selects the filter for a scaler factor
+ * fact: the scaler factor in 16.16 fixed point, input size / output size.
+ */
+uint32_t fe_coef_key(uint32_t dir, uint32_t fact)
+{
+
+	fact = clamp_t(uint32_t, fact, 1 << 16, FE_COEF_MAX_RATIO);
+	return FE_COEF_KEY(dir, DIV_ROUND_CLOSEST(fact,
+	    1 << FE_COEF_RATIO_SHIFT));
+}
+
+/*
+ * Keys cubic with a = -0.5, which also is what the u-boot vertical filter
+ * holds. x and the result are 16.16 fixed point.
+ */
+static int64_t fe_coef_cubic(int64_t x)
+{
+	int64_t t, t2, t3;
+
+	t = x < 0 ? -x : x;
+	t2 = (t * t) >> 16;
+	t3 = (t2 * t) >> 16;
+
+	if (t < (1 << 16))
+		return ((3 * t3 - 5 * t2) >> 1) + (1 << 16);
+	if (t < (2 << 16))
+		return (-t3 + 5 * t2 - 8 * t + (4 << 16)) >> 1;
+	return 0;
+}
+
+/*
+ * fe_coef_gen_phase() - generates the taps of one phase
+ *
+ * For down-scaling the kernel is stretched by the ratio, which lowers its
+ * cutoff to the output sample rate. Taps that fall outside the filter are
+ * dropped and the rest is normalised, any rounding error goes to the largest
+ * tap.
+ */
+static void fe_coef_gen_phase(uint32_t q, int nr_taps, int centre, int phase,
+    int8_t *taps)
+{
+	int64_t k[FE_COEF_HORZ_TAPS];
+	int64_t d, w, sum;
+	int i, total, max;
+
+	sum = 0;
+	for (i = 0; i < nr_taps; i++) {
+		d = ((int64_t)(i - centre) << 16) -
+		    ((int64_t)phase << FE_COEF_PHASE_SHIFT);
+		k[i] = fe_coef_cubic(div_s64(d * FE_COEF_RATIO_ONE, q));
+		sum += k[i];
+	}
+
+	total = 0;
+	max = centre;
+	for (i = 0; i < nr_taps; i++) {
+		w = k[i] * FE_COEF_SUM;
+		w += w < 0 ? -(sum >> 1) : sum >> 1;
+		taps[i] = div_s64(w, sum);
+		total += taps[i];
+		if (taps[i] > taps[max])
+			max = i;
+	}
+	taps[max] += FE_COEF_SUM - total;
+}
+
+static uint32_t fe_coef_pack(const int8_t *taps)
+{
+
+	return (uint8_t)taps[0] | ((uint8_t)taps[1] << 8) |
+	    ((uint8_t)taps[2] << 16) | ((uint32_t)(uint8_t)taps[3] << 24);
+}
+
+static void fe_coef_generate(struct fe_coef_entry *entry)
+{
+	int8_t taps[FE_COEF_HORZ_TAPS];
+	uint32_t q;
+	int i;
+
+	q = FE_COEF_KEY_RATIO(entry->key);
+
+	for (i = 0; i < DEFE_NR_COEF_PHASES; i++) {
+		if (FE_COEF_KEY_DIR(entry->key) == FE_COEF_DIR_HORZ) {
+			if (q == FE_COEF_RATIO_ONE) {
+				entry->bank[0][i] = fe_coef_sun4i.horz0[i];
+				entry->bank[1][i] = fe_coef_sun4i.horz1[i];
+				continue;
+			}
+			fe_coef_gen_phase(q, FE_COEF_HORZ_TAPS,
+			    FE_COEF_HORZ_CENTRE, i, taps);
+			entry->bank[0][i] = fe_coef_pack(&taps[0]);
+			entry->bank[1][i] = fe_coef_pack(&taps[4]);
+		} else {
+			if (q == FE_COEF_RATIO_ONE) {
+				entry->bank[0][i] = fe_coef_sun4i.vert[i];
+				continue;
+			}
+			fe_coef_gen_phase(q, FE_COEF_VERT_TAPS,
+			    FE_COEF_VERT_CENTRE, i, taps);
+			entry->bank[0][i] = fe_coef_pack(taps);
+		}
+	}
+}
+
+void fe_coef_cache_init(struct fe_coef_cache *cache)
+{
+
+	INIT_LIST_HEAD(&cache->lru);
+	cache->nr_entries = 0;
+}
+
+void fe_coef_cache_free(struct fe_coef_cache *cache)
+{
+	struct fe_coef_entry *entry, *tmp;
+
+	list_for_each_entry_safe(entry, tmp, &cache->lru, list) {
+		list_del(&entry->list);
+		kfree(entry);
+	}
+	cache->nr_entries = 0;
+}
+
+/*
+ * fe_coef_cache_get() - returns the filter for key, generating it on a miss
+ *
+ * When the cache is full the least recently used filter is recycled.
+ */
+const struct fe_coef_entry *fe_coef_cache_get(struct fe_coef_cache *cache,
+    uint32_t key)
+{
+	struct fe_coef_entry *entry;
+
+	list_for_each_entry(entry, &cache->lru, list) {
+		if (entry->key == key) {
+			list_move(&entry->list, &cache->lru);
+			return entry;
+		}
+	}
+
+	if (cache->nr_entries < FE_COEF_CACHE_SIZE) {
+		entry = kmalloc(sizeof(*entry), GFP_KERNEL);
+		if (!entry)
+			return NULL;
+		cache->nr_entries++;
+	} else {
+		entry = list_last_entry(&cache->lru, struct fe_coef_entry,
+		    list);
+		list_del(&entry->list);
+	}
+
+	entry->key = key;
+	fe_coef_generate(entry);
+	list_add(&entry->list, &cache->lru);
+
+	PRINT_DE_FE("de_fe generated %s filter for ratio %d/8\n",
+	    FE_COEF_KEY_DIR(key) == FE_COEF_DIR_HORZ ? "horz" : "vert",
+	    FE_COEF_KEY_RATIO(key));
+	return entry;
+}
+
+/*
+ * fe_coef_upload_entry() - writes the banks of one direction of a channel
+ *
+ * As for fe_coef_upload(), COEF_RDY still has to be set.
+ */
+int fe_coef_upload_entry(struct regmap *regs, uint32_t channel,
+    const struct fe_coef_entry *entry)
+{
+	uint32_t offset;
+	int ret;
+
+	offset = channel * DEFE_CH_COEF_OFFSET;
+
+	if (FE_COEF_KEY_DIR(entry->key) == FE_COEF_DIR_VERT)
+		return regmap_bulk_write(regs, DEFE_CH0_VERTCOEF + offset,
+		    entry->bank[0], DEFE_NR_COEF_PHASES);
+
+	ret = regmap_bulk_write(regs, DEFE_CH0_HORZCOEF0 + offset,
+	    entry->bank[0], DEFE_NR_COEF_PHASES);
+	if (ret)
+		return ret;
+
+	return regmap_bulk_write(regs, DEFE_CH0_HORZCOEF1 + offset,
+	    entry->bank[1], DEFE_NR_COEF_PHASES);
+}
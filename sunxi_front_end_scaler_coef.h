@@ -0,0 +1,80 @@
+/*
+ * Copyright (C) 2017 Vitsch Electronics
+ *
+ * Thomas van Kleef <linux-dev@vitsch.nl>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of
+ * the License, or (at your option) any later version.
+ */
+
+#ifndef SUNXI_FRONT_END_SCALER_COEF_H_
+#define SUNXI_FRONT_END_SCALER_COEF_H_
+
+#include <linux/list.h>
+#include <linux/regmap.h>
+#include "sunxi_front_end_registers.h"
+
+#define FE_COEF_DIR_HORZ	0
+#define FE_COEF_DIR_VERT	1
+
+/*
+ * Filters are generated per scale ratio, quantised to 1/8. Up-scaling and
+ * 1:1 use the u-boot filter, down-scaling beyond FE_COEF_MAX_RATIO uses the
+ * filter of FE_COEF_MAX_RATIO.
+ */
+#define FE_COEF_RATIO_SHIFT	13
+#define FE_COEF_RATIO_ONE	(1 << (16 - FE_COEF_RATIO_SHIFT))
+#define FE_COEF_MAX_RATIO	(4 << 16)
+#define FE_COEF_CACHE_SIZE	8
+
+/*
+ * fe_coef_set Polyphase filter of one scaler channel.
+ * horz0: Taps 0..3 of the 8 tap horizontal filter, one register per phase.
+ * horz1: Taps 4..7 of the 8 tap horizontal filter, one register per phase.
+ * vert: The 4 taps of the vertical filter, one register per phase.
+ *
+ * Every tap is a signed byte, the taps of a phase add up to 64.
+ */
+struct fe_coef_set {
+	uint32_t			horz0[DEFE_NR_COEF_PHASES];
+	uint32_t			horz1[DEFE_NR_COEF_PHASES];
+	uint32_t			vert[DEFE_NR_COEF_PHASES];
+};
+
+/*
+ * fe_coef_entry Generated filter banks of one direction.
+ * key: Direction and quantised ratio, see fe_coef_key().
+ * bank: horz0 and horz1 banks, or the vert bank in bank[0].
+ */
+struct fe_coef_entry {
+	struct list_head		list;
+	uint32_t			key;
+	uint32_t			bank[2][DEFE_NR_COEF_PHASES];
+};
+
+/*
+ * fe_coef_cache Generated filters, most recently used first.
+ */
+struct fe_coef_cache {
+	struct list_head		lru;
+	unsigned int			nr_entries;
+};
+
+extern const struct fe_coef_set fe_coef_sun4i;
+
+uint32_t fe_coef_key(uint32_t dir, uint32_t fact);
+void fe_coef_cache_init(struct fe_coef_cache *cache);
+void fe_coef_cache_free(struct fe_coef_cache *cache);
+const struct fe_coef_entry *fe_coef_cache_get(struct fe_coef_cache *cache,
+    uint32_t key);
+int fe_coef_upload_entry(struct regmap *regs, uint32_t channel,
+    const struct fe_coef_entry *entry);
+
+int fe_coef_upload(struct regmap *regs, uint32_t channel,
+    const struct fe_coef_set *set);
+int fe_coef_upload_all(struct regmap *regs, const struct fe_coef_set *ch0,
+    const struct fe_coef_set *ch1);
+
+#endif /* SUNXI_FRONT_END_SCALER_COEF_H_ */